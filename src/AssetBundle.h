@@ -0,0 +1,238 @@
+#ifndef _INCL_ASSETBUNDLE
+#define _INCL_ASSETBUNDLE
+
+/// Standard libraries
+#include <stddef.h>
+#include <stdint.h>
+#include <cstring>
+
+/// Project components
+#include "MappedFile.h"
+
+/// BundleEntryType
+///	 Identifies the kind of asset a bundle entry holds.
+enum BUNDLE_ENTRY
+{
+	/// An image, optionally divided into a spritesheet grid.
+	BUNDLE_IMAGE = 1,
+
+	/// A range of spritesheet indices played as an animation.
+	BUNDLE_ANIMATION = 2
+};
+
+/// BundleHeader
+///	 The start of a bundle file.  All values are little-endian.
+struct BundleHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t entryCount;
+
+	// Offset of the table of contents
+	uint32_t entries;
+};
+
+/// BundleEntry
+///	 An entry of the bundle table of contents.
+struct BundleEntry
+{
+	// Null-terminated name the asset is looked up by
+	char name[32];
+	uint32_t type;
+
+	// Images: the size of the image, the offset of its 32-bit 0xAARRGGBB pixels, and the offset of its
+	// 1-bit XBM mask or 0 if it has none
+	int32_t width;
+	int32_t height;
+	uint32_t pixels;
+	uint32_t mask;
+
+	// Images: the spritesheet grid, or 0 columns if the image is not a sheet
+	int32_t columns;
+	int32_t rows;
+	int32_t margins;
+
+	// Animations: the first and last sprite index
+	int32_t start;
+	int32_t end;
+
+	uint32_t reserved[2];
+};
+
+/// AssetBundle
+///	 A file of assets converted ahead of time into the form they are drawn in, described by a table of
+///  contents.  The file is memory-mapped and never parsed or converted, so images are used in place.
+///  Bundles are written by the bundlepack tool and loaded into images through XInfo::loadImage.
+class AssetBundle
+{
+public:
+	/// The bundle format version this class reads.
+	static const uint32_t VERSION = 1;
+
+	/// The alignment of pixel and mask data in the file.
+	static const uint32_t ALIGNMENT = 64;
+
+	/// Creates a new bundle with no file open.
+	AssetBundle(void)
+	{
+		header = NULL;
+		entries = NULL;
+	}
+
+	/// Opens a bundle file, checking that every entry lies within the file.
+	///  @filename The path of the bundle.
+	///  @returns True if successful, false otherwise.
+	bool open(const char* filename)
+	{
+		close();
+
+		// images point straight into the mapping, and written pixels must not reach the file
+		if(!file.open(filename, true))
+		{
+			return false;
+		}
+
+		size_t size = file.getSize();
+		BundleHeader* head = (BundleHeader*)file.getData();
+		if(size < sizeof(BundleHeader) || memcmp(head->magic, "XGLB", 4) != 0 || head->version != VERSION
+			|| head->entries > size || (size - head->entries) / sizeof(BundleEntry) < head->entryCount)
+		{
+			file.close();
+			return false;
+		}
+
+		BundleEntry* table = (BundleEntry*)(file.getData() + head->entries);
+		for(uint32_t i = 0; i < head->entryCount; i++)
+		{
+			if(!isValid(table[i], size))
+			{
+				file.close();
+				return false;
+			}
+		}
+
+		header = head;
+		entries = table;
+		return true;
+	}
+
+	/// Unmaps the bundle. Images loaded from it must be destroyed first.
+	void close(void)
+	{
+		file.close();
+		header = NULL;
+		entries = NULL;
+	}
+
+	/// Finds an entry of the bundle by name.
+	///  @name The name of the asset.
+	///  @type The kind of asset.
+	///  @returns The entry, or NULL if the bundle has no such asset.
+	const BundleEntry* find(const char* name, BUNDLE_ENTRY type)
+	{
+		for(uint32_t i = 0; header != NULL && i < header->entryCount; i++)
+		{
+			if(entries[i].type == (uint32_t)type && strcmp(entries[i].name, name) == 0)
+			{
+				return &entries[i];
+			}
+		}
+		return NULL;
+	}
+
+	/// Returns the pixels of an image entry.
+	///  @entry The image entry.
+	///  @returns The pixels, in rows of width pixels.
+	uint32_t* getPixels(const BundleEntry* entry)
+	{
+		return (uint32_t*)(file.getData() + entry->pixels);
+	}
+
+	/// Returns the mask of an image entry.
+	///  @entry The image entry.
+	///  @returns The mask bits in XBM format, or NULL if the image has no mask.
+	const unsigned char* getMask(const BundleEntry* entry)
+	{
+		return entry->mask != 0 ? file.getData() + entry->mask : NULL;
+	}
+
+	/// Reads an animation entry.
+	///  @name The name of the animation.
+	///  @start The first sprite index of the animation.
+	///  @end The last sprite index of the animation.
+	///  @returns True if the bundle has the animation, false otherwise.
+	bool getAnimation(const char* name, int* start, int* end)
+	{
+		const BundleEntry* entry = find(name, BUNDLE_ANIMATION);
+		if(entry == NULL)
+		{
+			return false;
+		}
+
+		*start = entry->start;
+		*end = entry->end;
+		return true;
+	}
+
+	/// Returns the number of entries in the bundle.
+	///  @returns The number of entries.
+	int getCount(void)
+	{
+		return header != NULL ? (int)header->entryCount : 0;
+	}
+
+	/// Returns an entry of the bundle.
+	///  @index The index of the entry.
+	///  @returns The entry.
+	const BundleEntry* get(int index)
+	{
+		return &entries[index];
+	}
+
+	/// Returns the size in bytes of the mask of an image.
+	///  @width The width of the image.
+	///  @height The height of the image.
+	///  @returns The size of the mask.
+	static size_t getMaskSize(int width, int height)
+	{
+		return (size_t)((width + 7) / 8) * height;
+	}
+
+private:
+	/// Determines whether an entry is well formed and its data lies within the file.
+	static bool isValid(const BundleEntry& entry, size_t size)
+	{
+		if(memchr(entry.name, 0, sizeof(entry.name)) == NULL)
+		{
+			return false;
+		}
+
+		if(entry.type != BUNDLE_IMAGE)
+		{
+			return entry.type == BUNDLE_ANIMATION && entry.start >= 0 && entry.start <= entry.end;
+		}
+
+		if(entry.width <= 0 || entry.height <= 0 || entry.pixels % 4 != 0 || entry.pixels > size
+			|| (size - entry.pixels) / 4 / entry.width < (size_t)entry.height)
+		{
+			return false;
+		}
+
+		if(entry.mask != 0 && (entry.mask > size || size - entry.mask < getMaskSize(entry.width, entry.height)))
+		{
+			return false;
+		}
+
+		return entry.columns == 0 || (entry.columns > 0 && entry.rows > 0 && entry.margins >= 0);
+	}
+
+	/// Bundles cannot be copied, as both copies would unmap the same file.
+	AssetBundle(const AssetBundle&);
+	AssetBundle& operator=(const AssetBundle&);
+
+	MappedFile file;
+	BundleHeader* header;
+	BundleEntry* entries;
+};
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef _INCL_ASSETCACHE
+#define _INCL_ASSETCACHE
+
+/// Standard libraries
+#include <stddef.h>
+#include <stdint.h>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+/// X11 libraries
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+/// Project components
+#include "MappedFile.h"
+
+/// AssetCache
+///	 Tracks the images shared between components.  Each image is found by the paths it was loaded from
+///  and by a hash of its file contents, so the same file is only decoded once, even when it is reached
+///  through different paths or copied under another name.  Images are reference counted, and the
+///  cache reports when the last reference to one is released so its owner can free it.
+class AssetCache
+{
+public:
+	/// Hashes file contents with 64-bit FNV-1a.
+	///  @data The contents.
+	///  @size The size of the contents in bytes.
+	///  @returns The hash.
+	static uint64_t hash(const unsigned char* data, size_t size)
+	{
+		uint64_t value = 14695981039346656037ULL;
+		for(size_t i = 0; i < size; i++)
+		{
+			value = (value ^ data[i]) * 1099511628211ULL;
+		}
+		return value;
+	}
+
+	/// Finds the image loaded from a path, adding a reference to it.
+	///  @path The canonical path of the file.
+	///  @returns The image, or NULL if no image was loaded from the path.
+	XImage* acquire(const std::string& path)
+	{
+		std::map<std::string, XImage*>::iterator found = paths.find(path);
+		if(found == paths.end())
+		{
+			return NULL;
+		}
+
+		entries[found->second].references++;
+		return found->second;
+	}
+
+	/// Finds the image loaded from a file with the same contents, adding a reference to it and recording
+	///  the path as another way to reach it. A file matching the hash and size is compared byte by byte
+	///  with the file the image was loaded from, so files whose hashes collide are never shared.
+	///  @path The canonical path of the file.
+	///  @contents The hash of the file contents.
+	///  @data The file contents.
+	///  @size The size of the file.
+	///  @returns The image, or NULL if no file with the same contents was loaded.
+	XImage* acquire(const std::string& path, uint64_t contents, const unsigned char* data, size_t size)
+	{
+		std::map<uint64_t, XImage*>::iterator found = hashes.find(contents);
+		if(found == hashes.end() || entries[found->second].size != size)
+		{
+			return NULL;
+		}
+
+		// the hash only finds a candidate; the contents decide
+		MappedFile original;
+		if(!original.open(entries[found->second].paths[0].c_str()) || original.getSize() != size
+			|| memcmp(original.getData(), data, size) != 0)
+		{
+			return NULL;
+		}
+
+		Entry& entry = entries[found->second];
+		entry.references++;
+		entry.paths.push_back(path);
+		paths[path] = found->second;
+		return found->second;
+	}
+
+	/// Adds an image to the cache with a single reference.
+	///  @path The canonical path of the file.
+	///  @contents The hash of the file contents.
+	///  @size The size of the file.
+	///  @image The image loaded from the file.
+	void add(const std::string& path, uint64_t contents, size_t size, XImage* image)
+	{
+		Entry& entry = entries[image];
+		entry.references = 1;
+		entry.contents = contents;
+		entry.size = size;
+		entry.mask = None;
+		entry.paths.push_back(path);
+
+		// an image whose hash collides with another's is only reached through its paths
+		paths[path] = image;
+		if(hashes.find(contents) == hashes.end())
+		{
+			hashes[contents] = image;
+		}
+	}
+
+	/// Records the clipping mask of a cached image, so it is counted in the memory used by the cache.
+	///  @image The image.
+	///  @mask The clipping mask.
+	void setMask(XImage* image, Pixmap mask)
+	{
+		std::map<XImage*, Entry>::iterator found = entries.find(image);
+		if(found != entries.end())
+		{
+			found->second.mask = mask;
+		}
+	}
+
+	/// Removes a reference to an image, and removes the image from the cache with its last reference.
+	///  @image The image.
+	///  @returns True if the last reference was removed and the image should be freed, false otherwise.
+	bool release(XImage* image)
+	{
+		std::map<XImage*, Entry>::iterator found = entries.find(image);
+		if(found == entries.end() || --found->second.references > 0)
+		{
+			return false;
+		}
+
+		Entry& entry = found->second;
+		for(size_t i = 0; i < entry.paths.size(); i++)
+		{
+			paths.erase(entry.paths[i]);
+		}
+		std::map<uint64_t, XImage*>::iterator hashed = hashes.find(entry.contents);
+		if(hashed != hashes.end() && hashed->second == image)
+		{
+			hashes.erase(hashed);
+		}
+		entries.erase(found);
+		return true;
+	}
+
+	/// Determines whether an image is owned by the cache.
+	///  @image The image.
+	///  @returns True if the image is cached, false otherwise.
+	bool contains(XImage* image)
+	{
+		return entries.find(image) != entries.end();
+	}
+
+	/// Returns the number of references to an image.
+	///  @image The image.
+	///  @returns The number of references, or 0 if the image is not cached.
+	int getReferences(XImage* image)
+	{
+		std::map<XImage*, Entry>::iterator found = entries.find(image);
+		return found != entries.end() ? found->second.references : 0;
+	}
+
+	/// Returns the number of images in the cache.
+	///  @returns The number of images.
+	int getCount(void)
+	{
+		return (int)entries.size();
+	}
+
+	/// Returns the memory used by the cached images and their clipping masks. Masks live on the server,
+	///  and are counted at one bit per pixel.
+	///  @returns The memory used, in bytes.
+	size_t getMemory(void)
+	{
+		size_t total = 0;
+		for(std::map<XImage*, Entry>::iterator i = entries.begin(); i != entries.end(); i++)
+		{
+			XImage* image = i->first;
+			total += (size_t)image->bytes_per_line * image->height;
+			if(i->second.mask != None)
+			{
+				total += (size_t)((image->width + 7) / 8) * image->height;
+			}
+		}
+		return total;
+	}
+
+private:
+	/// A cached image.
+	struct Entry
+	{
+		int references;
+		uint64_t contents;
+		size_t size;
+		Pixmap mask;
+		std::vector<std::string> paths;
+	};
+
+	std::map<XImage*, Entry> entries;
+	std::map<std::string, XImage*> paths;
+	std::map<uint64_t, XImage*> hashes;
+};
+
+#endif
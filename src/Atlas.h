@@ -0,0 +1,425 @@
+#ifndef _INCL_ATLAS
+#define _INCL_ATLAS
+
+/// Standard libraries
+#include <stddef.h>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+/// X11 libraries
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+/// Project components
+#include "Spritesheet.h"
+
+/// AtlasSprite
+///	 A handle to an image packed into an atlas: the page holding it and its rectangle on that page.
+struct AtlasSprite
+{
+	int page;
+	int x;
+	int y;
+	int width;
+	int height;
+};
+
+/// Atlas
+///	 Combines many images and spritesheets into a few large pages, so a scene draws from one or two
+///  source images instead of one per asset.  Images are placed with a skyline packer: the top edge of
+///  everything placed on a page is kept as a list of horizontal segments, and each image goes where it
+///  ends lowest.  Images are added first, then XInfo::buildAtlas packs them and copies their pixels.
+///  The images added must outlive the atlas, as it is built again from them after XInfo::destroyAtlas,
+///  and spritesheets are moved back onto them.
+class Atlas
+{
+public:
+	/// Creates a new atlas.
+	///  @width The width of each page.
+	///  @height The largest height of a page. Pages are cut down to the height they use.
+	Atlas(int width, int height)
+	{
+		pageWidth = width;
+		pageHeight = height;
+		built = false;
+	}
+
+	/// Adds a whole image to the atlas.
+	///  @image The image, which must outlive the atlas.
+	///  @returns The handle of the sprite.
+	int add(XImage* image)
+	{
+		return add(image, 0, 0, image->width, image->height);
+	}
+
+	/// Adds part of an image to the atlas.
+	///  @image The image, which must outlive the atlas.
+	///  @x The horizontal position of the part.
+	///  @y The vertical position of the part.
+	///  @width The width of the part.
+	///  @height The height of the part.
+	///  @returns The handle of the sprite.
+	int add(XImage* image, int x, int y, int width, int height)
+	{
+		Region region;
+		region.source = image;
+		region.sourceX = x;
+		region.sourceY = y;
+		region.sourceMask = None;
+		region.sheet = NULL;
+		regions.push_back(region);
+
+		AtlasSprite sprite = { -1, 0, 0, width, height };
+		sprites.push_back(sprite);
+		return (int)sprites.size() - 1;
+	}
+
+	/// Adds a spritesheet to the atlas. While the atlas is built, the sheet draws from its atlas page, and
+	///  once the pages are destroyed it draws from its own image again.
+	///  @sheet The spritesheet, which must outlive the atlas, as must its image.
+	///  @returns The handle of the sprite covering the whole sheet.
+	int add(Spritesheet* sheet)
+	{
+		int handle = add(sheet->getImage(), sheet->getOriginX(), sheet->getOriginY(), sheet->getWidth(), sheet->getHeight());
+		regions[handle].sourceMask = sheet->getMask();
+		regions[handle].sheet = sheet;
+		return handle;
+	}
+
+	/// Places every sprite on a page, opening pages as they fill up.
+	///  @returns True if every sprite fits on a page, false otherwise.
+	bool pack(void)
+	{
+		// placing the tallest images first leaves the flattest skyline
+		std::vector<int> order(sprites.size());
+		for(size_t i = 0; i < order.size(); i++)
+		{
+			order[i] = (int)i;
+		}
+		std::stable_sort(order.begin(), order.end(), TallerThan(sprites));
+
+		skylines.clear();
+		for(size_t i = 0; i < order.size(); i++)
+		{
+			AtlasSprite& sprite = sprites[order[i]];
+			if(sprite.width <= 0 || sprite.height <= 0 || sprite.width > pageWidth || sprite.height > pageHeight)
+			{
+				return false;
+			}
+
+			bool placed = false;
+			for(size_t page = 0; !placed && page < skylines.size(); page++)
+			{
+				placed = place(skylines[page], sprite);
+				sprite.page = (int)page;
+			}
+
+			if(!placed)
+			{
+				Skyline skyline;
+				Segment floor = { 0, 0, pageWidth };
+				skyline.push_back(floor);
+				skylines.push_back(skyline);
+
+				place(skylines.back(), sprite);
+				sprite.page = (int)skylines.size() - 1;
+			}
+		}
+		return true;
+	}
+
+	/// Returns the number of pages the sprites were packed into.
+	///  @returns The number of pages.
+	int getPageCount(void)
+	{
+		return (int)skylines.size();
+	}
+
+	/// Returns the width of a page.
+	///  @returns The page width.
+	int getPageWidth(void)
+	{
+		return pageWidth;
+	}
+
+	/// Returns the height a page uses.
+	///  @page The page.
+	///  @returns The page height.
+	int getPageHeight(int page)
+	{
+		int height = 0;
+		for(size_t i = 0; i < skylines[page].size(); i++)
+		{
+			height = std::max(height, skylines[page][i].y);
+		}
+		return height;
+	}
+
+	/// Copies the sprites of a page into its image. Pixels between sprites are left transparent.
+	///  @page The page.
+	///  @image The 32-bit image of the page, at least as large as the page.
+	void render(int page, XImage* image)
+	{
+		for(int row = 0; row < image->height; row++)
+		{
+			memset(image->data + row * image->bytes_per_line, 0, image->width * 4);
+		}
+
+		for(size_t i = 0; i < sprites.size(); i++)
+		{
+			const AtlasSprite& sprite = sprites[i];
+			const Region& region = regions[i];
+			if(sprite.page != page)
+			{
+				continue;
+			}
+
+			for(int row = 0; row < sprite.height; row++)
+			{
+				memcpy(image->data + (sprite.y + row) * image->bytes_per_line + sprite.x * 4,
+					region.source->data + (region.sourceY + row) * region.source->bytes_per_line + region.sourceX * 4,
+					sprite.width * 4);
+			}
+		}
+	}
+
+	/// Records the images of the pages once they are rendered, and moves the spritesheets in the atlas
+	///  onto their pages.
+	///  @images The image of each page.
+	///  @masks The clipping mask of each page.
+	void setPages(const std::vector<XImage*>& images, const std::vector<Pixmap>& masks)
+	{
+		pages = images;
+		pageMasks = masks;
+		surfaces.assign(pages.size(), None);
+		built = true;
+
+		for(size_t i = 0; i < sprites.size(); i++)
+		{
+			if(regions[i].sheet != NULL)
+			{
+				int page = sprites[i].page;
+				regions[i].sheet->setSource(pages[page], sprites[i].x, sprites[i].y, pageMasks[page]);
+			}
+		}
+	}
+
+	/// Forgets the pages of the atlas, once they are destroyed, and moves the spritesheets back onto their
+	///  own images.
+	void clearPages(void)
+	{
+		for(size_t i = 0; i < regions.size(); i++)
+		{
+			if(regions[i].sheet != NULL)
+			{
+				regions[i].sheet->setSource(regions[i].source, regions[i].sourceX, regions[i].sourceY, regions[i].sourceMask);
+			}
+		}
+
+		pages.clear();
+		pageMasks.clear();
+		surfaces.clear();
+		built = false;
+	}
+
+	/// Determines whether the atlas was built into pages.
+	///  @returns True if the pages exist, false otherwise.
+	bool isBuilt(void)
+	{
+		return built;
+	}
+
+	/// Returns the image of a page.
+	///  @page The page.
+	///  @returns The page image.
+	XImage* getPage(int page)
+	{
+		return pages[page];
+	}
+
+	/// Returns the clipping mask of a page.
+	///  @page The page.
+	///  @returns The page mask, or None.
+	Pixmap getPageMask(int page)
+	{
+		return pageMasks[page];
+	}
+
+	/// Returns the server-side copy of a page.
+	///  @page The page.
+	///  @returns The page pixmap, or None if the page has not been uploaded.
+	Pixmap getSurface(int page)
+	{
+		return surfaces[page];
+	}
+
+	/// Sets the server-side copy of a page, and of the spritesheets on it.
+	///  @page The page.
+	///  @value The page pixmap.
+	void setSurface(int page, Pixmap value)
+	{
+		surfaces[page] = value;
+		for(size_t i = 0; i < sprites.size(); i++)
+		{
+			if(sprites[i].page == page && regions[i].sheet != NULL)
+			{
+				regions[i].sheet->setSurface(value);
+			}
+		}
+	}
+
+	/// Returns a sprite of the atlas.
+	///  @handle The handle returned when the sprite was added.
+	///  @returns The sprite, whose page is -1 until the atlas is packed.
+	const AtlasSprite& get(int handle)
+	{
+		return sprites[handle];
+	}
+
+	/// Returns the spritesheet a sprite was added from.
+	///  @handle The handle returned when the sprite was added.
+	///  @returns The spritesheet, or NULL if the sprite was added from an image.
+	Spritesheet* getSheet(int handle)
+	{
+		return regions[handle].sheet;
+	}
+
+	/// Returns the number of sprites in the atlas.
+	///  @returns The number of sprites.
+	int getCount(void)
+	{
+		return (int)sprites.size();
+	}
+
+private:
+	/// A horizontal run of the skyline, at the height of the sprites below it.
+	struct Segment
+	{
+		int x;
+		int y;
+		int width;
+	};
+
+	typedef std::vector<Segment> Skyline;
+
+	/// Where the pixels of a sprite are copied from.
+	struct Region
+	{
+		XImage* source;
+		int sourceX;
+		int sourceY;
+		Pixmap sourceMask;
+		Spritesheet* sheet;
+	};
+
+	/// Orders sprite handles by descending height.
+	struct TallerThan
+	{
+		TallerThan(const std::vector<AtlasSprite>& list) : sprites(list) {}
+
+		bool operator()(int a, int b) const
+		{
+			return sprites[a].height > sprites[b].height;
+		}
+
+		const std::vector<AtlasSprite>& sprites;
+	};
+
+	/// Places a sprite on the skyline of a page, where its bottom edge ends lowest.
+	///  @skyline The skyline of the page.
+	///  @sprite The sprite, whose position is set if it fits.
+	///  @returns True if the sprite fits on the page, false otherwise.
+	bool place(Skyline& skyline, AtlasSprite& sprite)
+	{
+		int best = -1, bestY = 0, bestWaste = 0;
+		for(size_t i = 0; i < skyline.size(); i++)
+		{
+			int x = skyline[i].x;
+			if(x + sprite.width > pageWidth)
+			{
+				break;
+			}
+
+			// the sprite rests on the highest segment it spans
+			int y = 0;
+			for(size_t j = i; j < skyline.size() && skyline[j].x < x + sprite.width; j++)
+			{
+				y = std::max(y, skyline[j].y);
+			}
+			if(y + sprite.height > pageHeight)
+			{
+				continue;
+			}
+
+			// the gaps left under the sprite break ties between equally low positions
+			int waste = 0;
+			for(size_t j = i; j < skyline.size() && skyline[j].x < x + sprite.width; j++)
+			{
+				int right = std::min(skyline[j].x + skyline[j].width, x + sprite.width);
+				waste += (y - skyline[j].y) * (right - skyline[j].x);
+			}
+
+			if(best < 0 || y < bestY || (y == bestY && waste < bestWaste))
+			{
+				best = (int)i;
+				bestY = y;
+				bestWaste = waste;
+			}
+		}
+
+		if(best < 0)
+		{
+			return false;
+		}
+
+		sprite.x = skyline[best].x;
+		sprite.y = bestY;
+
+		// the sprite top replaces the segments it covers, and a segment it partly covers is cut short
+		Segment top = { sprite.x, bestY + sprite.height, sprite.width };
+		int right = sprite.x + sprite.width;
+		size_t end = best;
+		while(end < skyline.size() && skyline[end].x + skyline[end].width <= right)
+		{
+			end++;
+		}
+		if(end < skyline.size() && skyline[end].x < right)
+		{
+			skyline[end].width -= right - skyline[end].x;
+			skyline[end].x = right;
+		}
+		skyline.erase(skyline.begin() + best, skyline.begin() + end);
+		skyline.insert(skyline.begin() + best, top);
+
+		// neighbouring segments at the same height are merged, so wide sprites see one run
+		for(size_t i = 0; i + 1 < skyline.size(); )
+		{
+			if(skyline[i].y == skyline[i + 1].y)
+			{
+				skyline[i].width += skyline[i + 1].width;
+				skyline.erase(skyline.begin() + i + 1);
+			}
+			else
+			{
+				i++;
+			}
+		}
+		return true;
+	}
+
+	int pageWidth;
+	int pageHeight;
+
+	std::vector<AtlasSprite> sprites;
+	std::vector<Region> regions;
+	std::vector<Skyline> skylines;
+
+	// Page images, masks and server-side copies, once built
+	bool built;
+	std::vector<XImage*> pages;
+	std::vector<Pixmap> pageMasks;
+	std::vector<Pixmap> surfaces;
+};
+
+#endif
@@ -0,0 +1,433 @@
+#ifndef _INCL_BLITTER
+#define _INCL_BLITTER
+
+/// Standard libraries
+#include <stdint.h>
+#include <cstring>
+
+/// SIMD libraries
+#if defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BLITTER_X86 1
+#endif
+
+/// Contains the pixel row operations used by the software compositor.  Pixels are 32-bit values laid
+///  out as 0xAARRGGBB, which matches the byte order of a 24-bit TrueColor XImage on little-endian hosts.
+///  Each operation is implemented in scalar, SSE2 and AVX2 form, and the widest one supported by the
+///  processor is selected at runtime.  The mask packing operations have no AVX2 form, as they are only
+///  run when images are loaded.
+namespace Blitter
+{
+	/// The alpha component of a pixel.
+	static const uint32_t ALPHA_MASK = 0xFF000000u;
+
+	/// The color components of a pixel.
+	static const uint32_t COLOR_MASK = 0x00FFFFFFu;
+
+	/// Blends a source pixel over a destination pixel using the source alpha.
+	///  @src The source pixel.
+	///  @dst The destination pixel.
+	///  @returns The blended pixel.
+	static inline uint32_t blendPixel(uint32_t src, uint32_t dst)
+	{
+		uint32_t a = src >> 24;
+		uint32_t ia = 255 - a;
+		uint32_t result = 0;
+
+		for(int shift = 0; shift < 32; shift += 8)
+		{
+			uint32_t t = ((src >> shift) & 0xFF) * a + ((dst >> shift) & 0xFF) * ia + 128;
+			result |= (((t + (t >> 8)) >> 8) & 0xFF) << shift;
+		}
+		return result;
+	}
+
+	/// Blends a row of source pixels over a row of destination pixels.
+	///  @dst The destination row.
+	///  @src The source row.
+	///  @count The number of pixels.
+	static inline void blendRowScalar(uint32_t* dst, const uint32_t* src, int count)
+	{
+		for(int i = 0; i < count; i++)
+		{
+			uint32_t a = src[i] & ALPHA_MASK;
+			if(a == ALPHA_MASK)
+			{
+				dst[i] = src[i];
+			}
+			else if(a != 0)
+			{
+				dst[i] = blendPixel(src[i], dst[i]);
+			}
+		}
+	}
+
+	/// Copies a row of source pixels, skipping those that match the color key.
+	///  @dst The destination row.
+	///  @src The source row.
+	///  @count The number of pixels.
+	///  @key The transparent color.
+	static inline void keyRowScalar(uint32_t* dst, const uint32_t* src, int count, uint32_t key)
+	{
+		for(int i = 0; i < count; i++)
+		{
+			if((src[i] & COLOR_MASK) != key)
+			{
+				dst[i] = src[i];
+			}
+		}
+	}
+
+	/// Fills a row of pixels with a color.
+	///  @dst The destination row.
+	///  @count The number of pixels.
+	///  @color The color to fill with.
+	static inline void fillRowScalar(uint32_t* dst, int count, uint32_t color)
+	{
+		for(int i = 0; i < count; i++)
+		{
+			dst[i] = color;
+		}
+	}
+
+	/// Packs a row of pixels into 1-bit mask bits, least significant bit first, setting the pixels with
+	///  at least half alpha.
+	///  @bits The mask row, of (count + 7) / 8 bytes.
+	///  @src The source row.
+	///  @count The number of pixels.
+	static inline void alphaMaskRowScalar(unsigned char* bits, const uint32_t* src, int count)
+	{
+		memset(bits, 0, (count + 7) / 8);
+		for(int i = 0; i < count; i++)
+		{
+			if(src[i] & 0x80000000u)
+			{
+				bits[i >> 3] |= 1 << (i & 7);
+			}
+		}
+	}
+
+	/// Packs a row of pixels into 1-bit mask bits, least significant bit first, setting the pixels that
+	///  do not match the color key.
+	///  @bits The mask row, of (count + 7) / 8 bytes.
+	///  @src The source row.
+	///  @count The number of pixels.
+	///  @key The transparent color.
+	static inline void keyMaskRowScalar(unsigned char* bits, const uint32_t* src, int count, uint32_t key)
+	{
+		memset(bits, 0, (count + 7) / 8);
+		for(int i = 0; i < count; i++)
+		{
+			if((src[i] & COLOR_MASK) != key)
+			{
+				bits[i >> 3] |= 1 << (i & 7);
+			}
+		}
+	}
+
+#ifdef BLITTER_X86
+	/// Blends two 16-bit unpacked pixels; see blendPixel.
+	static inline __m128i blend2(__m128i s, __m128i d, __m128i inverse, __m128i half)
+	{
+		__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		__m128i ia = _mm_xor_si128(a, inverse);
+		__m128i t = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(d, ia)), half);
+		return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+	}
+
+	/// Blends a row of source pixels over a row of destination pixels, four pixels at a time.
+	static inline void blendRowSSE2(uint32_t* dst, const uint32_t* src, int count)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i alpha = _mm_set1_epi32((int)ALPHA_MASK);
+		const __m128i inverse = _mm_set1_epi16(0xFF);
+		const __m128i half = _mm_set1_epi16(128);
+
+		int i = 0;
+		for(; i + 4 <= count; i += 4)
+		{
+			__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+			__m128i a = _mm_and_si128(s, alpha);
+
+			// most sprite pixels are either fully opaque or fully transparent
+			int opaque = _mm_movemask_epi8(_mm_cmpeq_epi32(a, alpha));
+			if(opaque == 0xFFFF)
+			{
+				_mm_storeu_si128((__m128i*)(dst + i), s);
+				continue;
+			}
+			int transparent = _mm_movemask_epi8(_mm_cmpeq_epi32(a, zero));
+			if(transparent == 0xFFFF)
+			{
+				continue;
+			}
+
+			__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+			__m128i lo = blend2(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero), inverse, half);
+			__m128i hi = blend2(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero), inverse, half);
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+		}
+		blendRowScalar(dst + i, src + i, count - i);
+	}
+
+	/// Copies a row of source pixels, skipping those that match the color key, four pixels at a time.
+	static inline void keyRowSSE2(uint32_t* dst, const uint32_t* src, int count, uint32_t key)
+	{
+		const __m128i colors = _mm_set1_epi32((int)COLOR_MASK);
+		const __m128i keys = _mm_set1_epi32((int)key);
+
+		int i = 0;
+		for(; i + 4 <= count; i += 4)
+		{
+			__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+			__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+			__m128i m = _mm_cmpeq_epi32(_mm_and_si128(s, colors), keys);
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(m, d), _mm_andnot_si128(m, s)));
+		}
+		keyRowScalar(dst + i, src + i, count - i, key);
+	}
+
+	/// Fills a row of pixels with a color, four pixels at a time.
+	static inline void fillRowSSE2(uint32_t* dst, int count, uint32_t color)
+	{
+		const __m128i c = _mm_set1_epi32((int)color);
+
+		int i = 0;
+		for(; i + 4 <= count; i += 4)
+		{
+			_mm_storeu_si128((__m128i*)(dst + i), c);
+		}
+		fillRowScalar(dst + i, count - i, color);
+	}
+
+	/// Packs a row of pixel alphas into mask bits, eight pixels to a byte. The top bit of each alpha is
+	///  the sign bit of its pixel, so a movemask packs four at once.
+	static inline void alphaMaskRowSSE2(unsigned char* bits, const uint32_t* src, int count)
+	{
+		int i = 0;
+		for(; i + 8 <= count; i += 8)
+		{
+			__m128i low = _mm_loadu_si128((const __m128i*)(src + i));
+			__m128i high = _mm_loadu_si128((const __m128i*)(src + i + 4));
+			bits[i >> 3] = (unsigned char)(_mm_movemask_ps(_mm_castsi128_ps(low)) | (_mm_movemask_ps(_mm_castsi128_ps(high)) << 4));
+		}
+		alphaMaskRowScalar(bits + (i >> 3), src + i, count - i);
+	}
+
+	/// Packs a row of color key comparisons into mask bits, eight pixels to a byte.
+	static inline void keyMaskRowSSE2(unsigned char* bits, const uint32_t* src, int count, uint32_t key)
+	{
+		const __m128i k = _mm_set1_epi32((int)key);
+		const __m128i colorMask = _mm_set1_epi32((int)COLOR_MASK);
+
+		int i = 0;
+		for(; i + 8 <= count; i += 8)
+		{
+			__m128i low = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128((const __m128i*)(src + i)), colorMask), k);
+			__m128i high = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128((const __m128i*)(src + i + 4)), colorMask), k);
+			int matches = _mm_movemask_ps(_mm_castsi128_ps(low)) | (_mm_movemask_ps(_mm_castsi128_ps(high)) << 4);
+			bits[i >> 3] = (unsigned char)~matches;
+		}
+		keyMaskRowScalar(bits + (i >> 3), src + i, count - i, key);
+	}
+
+	/// Blends four 16-bit unpacked pixels; see blendPixel.
+	__attribute__((target("avx2")))
+	static inline __m256i blend4(__m256i s, __m256i d, __m256i inverse, __m256i half)
+	{
+		__m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		__m256i ia = _mm256_xor_si256(a, inverse);
+		__m256i t = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(s, a), _mm256_mullo_epi16(d, ia)), half);
+		return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+	}
+
+	/// Blends a row of source pixels over a row of destination pixels, eight pixels at a time.
+	__attribute__((target("avx2")))
+	static inline void blendRowAVX2(uint32_t* dst, const uint32_t* src, int count)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i alpha = _mm256_set1_epi32((int)ALPHA_MASK);
+		const __m256i inverse = _mm256_set1_epi16(0xFF);
+		const __m256i half = _mm256_set1_epi16(128);
+
+		int i = 0;
+		for(; i + 8 <= count; i += 8)
+		{
+			__m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+			__m256i a = _mm256_and_si256(s, alpha);
+
+			if(_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, alpha)) == -1)
+			{
+				_mm256_storeu_si256((__m256i*)(dst + i), s);
+				continue;
+			}
+			if(_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, zero)) == -1)
+			{
+				continue;
+			}
+
+			// unpack and pack both work within 128-bit lanes, so the pixel order is preserved
+			__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+			__m256i lo = blend4(_mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero), inverse, half);
+			__m256i hi = blend4(_mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero), inverse, half);
+			_mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(lo, hi));
+		}
+		blendRowSSE2(dst + i, src + i, count - i);
+	}
+
+	/// Copies a row of source pixels, skipping those that match the color key, eight pixels at a time.
+	__attribute__((target("avx2")))
+	static inline void keyRowAVX2(uint32_t* dst, const uint32_t* src, int count, uint32_t key)
+	{
+		const __m256i colors = _mm256_set1_epi32((int)COLOR_MASK);
+		const __m256i keys = _mm256_set1_epi32((int)key);
+
+		int i = 0;
+		for(; i + 8 <= count; i += 8)
+		{
+			__m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+			__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+			__m256i m = _mm256_cmpeq_epi32(_mm256_and_si256(s, colors), keys);
+			_mm256_storeu_si256((__m256i*)(dst + i), _mm256_blendv_epi8(s, d, m));
+		}
+		keyRowSSE2(dst + i, src + i, count - i, key);
+	}
+
+	/// Fills a row of pixels with a color, eight pixels at a time.
+	__attribute__((target("avx2")))
+	static inline void fillRowAVX2(uint32_t* dst, int count, uint32_t color)
+	{
+		const __m256i c = _mm256_set1_epi32((int)color);
+
+		int i = 0;
+		for(; i + 8 <= count; i += 8)
+		{
+			_mm256_storeu_si256((__m256i*)(dst + i), c);
+		}
+		fillRowSSE2(dst + i, count - i, color);
+	}
+#endif
+
+	/// The widest instruction set available to the blitter.
+	enum SIMD_LEVEL
+	{
+		SIMD_SCALAR = 0,
+		SIMD_SSE2 = 1,
+		SIMD_AVX2 = 2
+	};
+
+	/// Returns the widest instruction set supported by the processor.
+	///  @returns The supported instruction set.
+	static SIMD_LEVEL getLevel(void)
+	{
+#ifdef BLITTER_X86
+		static const SIMD_LEVEL level = __builtin_cpu_supports("avx2") ? SIMD_AVX2 : (__builtin_cpu_supports("sse2") ? SIMD_SSE2 : SIMD_SCALAR);
+		return level;
+#else
+		return SIMD_SCALAR;
+#endif
+	}
+
+	/// Blends a row of source pixels over a row of destination pixels using the source alpha.
+	///  @dst The destination row.
+	///  @src The source row.
+	///  @count The number of pixels.
+	static inline void blendRow(uint32_t* dst, const uint32_t* src, int count)
+	{
+#ifdef BLITTER_X86
+		switch(getLevel())
+		{
+		case SIMD_AVX2:
+			blendRowAVX2(dst, src, count);
+			return;
+		case SIMD_SSE2:
+			blendRowSSE2(dst, src, count);
+			return;
+		default:
+			break;
+		}
+#endif
+		blendRowScalar(dst, src, count);
+	}
+
+	/// Copies a row of source pixels, skipping those that match the color key.
+	///  @dst The destination row.
+	///  @src The source row.
+	///  @count The number of pixels.
+	///  @key The transparent color.
+	static inline void keyRow(uint32_t* dst, const uint32_t* src, int count, uint32_t key)
+	{
+#ifdef BLITTER_X86
+		switch(getLevel())
+		{
+		case SIMD_AVX2:
+			keyRowAVX2(dst, src, count, key);
+			return;
+		case SIMD_SSE2:
+			keyRowSSE2(dst, src, count, key);
+			return;
+		default:
+			break;
+		}
+#endif
+		keyRowScalar(dst, src, count, key);
+	}
+
+	/// Fills a row of pixels with a color.
+	///  @dst The destination row.
+	///  @count The number of pixels.
+	///  @color The color to fill with.
+	static inline void fillRow(uint32_t* dst, int count, uint32_t color)
+	{
+#ifdef BLITTER_X86
+		switch(getLevel())
+		{
+		case SIMD_AVX2:
+			fillRowAVX2(dst, count, color);
+			return;
+		case SIMD_SSE2:
+			fillRowSSE2(dst, count, color);
+			return;
+		default:
+			break;
+		}
+#endif
+		fillRowScalar(dst, count, color);
+	}
+
+	/// Packs a row of pixels into 1-bit mask bits, setting the pixels with at least half alpha.
+	///  @bits The mask row, of (count + 7) / 8 bytes, in XBM bit order.
+	///  @src The source row.
+	///  @count The number of pixels.
+	static inline void alphaMaskRow(unsigned char* bits, const uint32_t* src, int count)
+	{
+#ifdef BLITTER_X86
+		if(getLevel() != SIMD_SCALAR)
+		{
+			alphaMaskRowSSE2(bits, src, count);
+			return;
+		}
+#endif
+		alphaMaskRowScalar(bits, src, count);
+	}
+
+	/// Packs a row of pixels into 1-bit mask bits, setting the pixels that do not match the color key.
+	///  @bits The mask row, of (count + 7) / 8 bytes, in XBM bit order.
+	///  @src The source row.
+	///  @count The number of pixels.
+	///  @key The transparent color.
+	static inline void keyMaskRow(unsigned char* bits, const uint32_t* src, int count, uint32_t key)
+	{
+		key &= COLOR_MASK;
+#ifdef BLITTER_X86
+		if(getLevel() != SIMD_SCALAR)
+		{
+			keyMaskRowSSE2(bits, src, count, key);
+			return;
+		}
+#endif
+		keyMaskRowScalar(bits, src, count, key);
+	}
+}
+
+#endif
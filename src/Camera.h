@@ -0,0 +1,223 @@
+#ifndef _INCL_CAMERA
+#define _INCL_CAMERA
+
+/// Standard libraries
+#include <math.h>
+
+/// Camera
+///	 The view of the world shown on the screen.  Every XInfo draw call takes world coordinates and is
+///  moved to the screen by the camera, and draws falling entirely outside the view are skipped before
+///  any work is done for them.  The camera can be disabled to draw in screen coordinates, such as for
+///  an overlay, and can be kept within the bounds of a level.
+class Camera
+{
+public:
+	/// Initializes a new instance of Camera, at the origin with an empty view.
+	Camera(void)
+	{
+		_x = 0;
+		_y = 0;
+		_width = 0;
+		_height = 0;
+		_enabled = true;
+		_bounded = false;
+		_boundLeft = 0;
+		_boundTop = 0;
+		_boundRight = 0;
+		_boundBottom = 0;
+		_offsetX = 0;
+		_offsetY = 0;
+	}
+
+	/// Sets the position of the top-left of the view in the world.
+	///  @x The x-coordinate (in world coordinates) of the view.
+	///  @y The y-coordinate (in world coordinates) of the view.
+	void setPosition(float x, float y)
+	{
+		_x = x;
+		_y = y;
+		clamp();
+	}
+
+	/// Moves the view by an amount.
+	///  @dx The horizontal distance to move.
+	///  @dy The vertical distance to move.
+	void move(float dx, float dy)
+	{
+		setPosition(_x + dx, _y + dy);
+	}
+
+	/// Moves the view so that a point of the world is at its center.
+	///  @x The x-coordinate (in world coordinates) of the point.
+	///  @y The y-coordinate (in world coordinates) of the point.
+	void centerOn(float x, float y)
+	{
+		setPosition(x - _width / 2.0f, y - _height / 2.0f);
+	}
+
+	/// Gets the x-coordinate of the top-left of the view.
+	///  @returns The x-coordinate (in world coordinates) of the view.
+	float getX(void)
+	{
+		return _x;
+	}
+
+	/// Gets the y-coordinate of the top-left of the view.
+	///  @returns The y-coordinate (in world coordinates) of the view.
+	float getY(void)
+	{
+		return _y;
+	}
+
+	/// Gets the whole-pixel horizontal offset subtracted from world coordinates.
+	///  @returns The horizontal offset, or 0 if the camera is disabled.
+	int getOffsetX(void)
+	{
+		return _enabled ? _offsetX : 0;
+	}
+
+	/// Gets the whole-pixel vertical offset subtracted from world coordinates.
+	///  @returns The vertical offset, or 0 if the camera is disabled.
+	int getOffsetY(void)
+	{
+		return _enabled ? _offsetY : 0;
+	}
+
+	/// Sets the size of the view, which is the size of the image buffer.
+	///  @width The width of the view.
+	///  @height The height of the view.
+	void setSize(int width, int height)
+	{
+		_width = width;
+		_height = height;
+		clamp();
+	}
+
+	/// Gets the width of the view.
+	///  @returns The width of the view.
+	int getWidth(void)
+	{
+		return _width;
+	}
+
+	/// Gets the height of the view.
+	///  @returns The height of the view.
+	int getHeight(void)
+	{
+		return _height;
+	}
+
+	/// Keeps the view within an area of the world, such as the extent of a level. An area smaller than
+	///  the view keeps the view at its top-left.
+	///  @left The x-coordinate (in world coordinates) of the area.
+	///  @top The y-coordinate (in world coordinates) of the area.
+	///  @width The width of the area.
+	///  @height The height of the area.
+	void setBounds(float left, float top, float width, float height)
+	{
+		_bounded = true;
+		_boundLeft = left;
+		_boundTop = top;
+		_boundRight = left + width;
+		_boundBottom = top + height;
+		clamp();
+	}
+
+	/// Lets the view move anywhere in the world.
+	void clearBounds(void)
+	{
+		_bounded = false;
+	}
+
+	/// Returns true if draws are moved by the camera, false if they are in screen coordinates.
+	///  @returns True if the camera is enabled, false otherwise.
+	bool isEnabled(void)
+	{
+		return _enabled;
+	}
+
+	/// Sets whether draws are moved by the camera. Disable the camera to draw in screen coordinates.
+	///  @value The value to set.
+	void setEnabled(bool value)
+	{
+		_enabled = value;
+	}
+
+	/// Determines whether any part of a rectangle of the world is in view.
+	///  @x The x-coordinate (in world coordinates) of the rectangle.
+	///  @y The y-coordinate (in world coordinates) of the rectangle.
+	///  @width The width of the rectangle.
+	///  @height The height of the rectangle.
+	///  @returns True if the rectangle overlaps the view, false otherwise.
+	bool isVisible(int x, int y, int width, int height)
+	{
+		x -= getOffsetX();
+		y -= getOffsetY();
+		return x < _width && y < _height && x + width > 0 && y + height > 0;
+	}
+
+	/// Converts a horizontal world coordinate to a screen coordinate.
+	///  @x The x-coordinate (in world coordinates).
+	///  @returns The x-coordinate (in screen coordinates).
+	int toScreenX(int x)
+	{
+		return x - getOffsetX();
+	}
+
+	/// Converts a vertical world coordinate to a screen coordinate.
+	///  @y The y-coordinate (in world coordinates).
+	///  @returns The y-coordinate (in screen coordinates).
+	int toScreenY(int y)
+	{
+		return y - getOffsetY();
+	}
+
+	/// Converts a horizontal screen coordinate, such as the mouse position, to a world coordinate.
+	///  @x The x-coordinate (in screen coordinates).
+	///  @returns The x-coordinate (in world coordinates).
+	int toWorldX(int x)
+	{
+		return x + getOffsetX();
+	}
+
+	/// Converts a vertical screen coordinate, such as the mouse position, to a world coordinate.
+	///  @y The y-coordinate (in screen coordinates).
+	///  @returns The y-coordinate (in world coordinates).
+	int toWorldY(int y)
+	{
+		return y + getOffsetY();
+	}
+
+private:
+	/// Keeps the view within its bounds, and rounds the position to whole pixels for drawing.
+	void clamp(void)
+	{
+		if(_bounded)
+		{
+			_x = fmaxf(fminf(_x, _boundRight - _width), _boundLeft);
+			_y = fmaxf(fminf(_y, _boundBottom - _height), _boundTop);
+		}
+
+		_offsetX = (int)floorf(_x);
+		_offsetY = (int)floorf(_y);
+	}
+
+	float _x;
+	float _y;
+	int _width;
+	int _height;
+	bool _enabled;
+
+	// Area the view is kept within
+	bool _bounded;
+	float _boundLeft;
+	float _boundTop;
+	float _boundRight;
+	float _boundBottom;
+
+	// Whole-pixel position of the view
+	int _offsetX;
+	int _offsetY;
+};
+
+#endif
@@ -0,0 +1,524 @@
+#ifndef _INCL_COMPONENTREGISTRY
+#define _INCL_COMPONENTREGISTRY
+
+/// Standard libraries
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+/// Project components
+#include "Displayable.h"
+
+/// ComponentRegistry
+///	 The components of a game, kept in contiguous arrays.  Each component has an update order and a draw
+///  layer, lower values running first, with ties kept in the order the components were added.  Disabled
+///  components are left out of the update sequence and hidden ones out of the draw sequence, so parked
+///  components cost nothing per frame.
+///
+///  Components may be added, removed, reordered or toggled at any time, including while the sequences
+///  are being walked; the changes take effect when commit is called at the next frame boundary.
+///
+///  A component can depend on others, which then update before it whatever their update order, and
+///  can be marked parallel-safe to update on a worker thread alongside the other parallel-safe
+///  components it does not depend on.
+class ComponentRegistry
+{
+public:
+	/// Creates a new empty registry.
+	ComponentRegistry(void)
+	{
+		serial = 0;
+		revision = 0;
+		dirty = false;
+	}
+
+	/// Adds a component, updated and drawn in the order it was added. Takes effect at the next commit.
+	///  @component The component to add.
+	void add(Displayable* component)
+	{
+		add(component, 0, 0);
+	}
+
+	/// Adds a component. Takes effect at the next commit.
+	///  @component The component to add.
+	///  @updateOrder The update order key; lower keys update first.
+	///  @drawLayer The draw layer key; lower layers are drawn first, under higher ones.
+	void add(Displayable* component, int updateOrder, int drawLayer)
+	{
+		Change change = { { component, updateOrder, drawLayer, 0, true, true, false, std::vector<Displayable*>() }, true };
+		changes.push_back(change);
+	}
+
+	/// Removes a component. Takes effect at the next commit.
+	///  @component The component to remove.
+	void remove(Displayable* component)
+	{
+		Change change = { { component, 0, 0, 0, false, false, false, std::vector<Displayable*>() }, false };
+		changes.push_back(change);
+	}
+
+	/// Sets whether a component is updated. Takes effect at the next commit.
+	///  @component The component.
+	///  @value True to update the component, false to skip it.
+	void setEnabled(Displayable* component, bool value)
+	{
+		Entry* entry = find(component);
+		if(entry != NULL && entry->enabled != value)
+		{
+			entry->enabled = value;
+			dirty = true;
+		}
+	}
+
+	/// Sets whether a component is drawn. Takes effect at the next commit.
+	///  @component The component.
+	///  @value True to draw the component, false to skip it.
+	void setVisible(Displayable* component, bool value)
+	{
+		Entry* entry = find(component);
+		if(entry != NULL && entry->visible != value)
+		{
+			entry->visible = value;
+			dirty = true;
+		}
+	}
+
+	/// Sets the update order of a component. Takes effect at the next commit.
+	///  @component The component.
+	///  @value The update order key; lower keys update first.
+	void setUpdateOrder(Displayable* component, int value)
+	{
+		Entry* entry = find(component);
+		if(entry != NULL && entry->updateOrder != value)
+		{
+			entry->updateOrder = value;
+			dirty = true;
+		}
+	}
+
+	/// Sets the draw layer of a component. Takes effect at the next commit.
+	///  @component The component.
+	///  @value The draw layer key; lower layers are drawn first, under higher ones.
+	void setDrawLayer(Displayable* component, int value)
+	{
+		Entry* entry = find(component);
+		if(entry != NULL && entry->drawLayer != value)
+		{
+			entry->drawLayer = value;
+			dirty = true;
+		}
+	}
+
+	/// Sets whether a component may update on a worker thread, at the same time as the other parallel-safe
+	///  components it does not depend on. Takes effect at the next commit.
+	///
+	///  A parallel-safe component must not draw or change shared state in update, other than its own and
+	///  that of components depending on it. Components that are not parallel-safe update on the calling
+	///  thread, alone, after every component before them in the update sequence.
+	///  @component The component.
+	///  @value True to let the component update in parallel, false to update it alone.
+	void setParallelSafe(Displayable* component, bool value)
+	{
+		Entry* entry = find(component);
+		if(entry != NULL && entry->parallel != value)
+		{
+			entry->parallel = value;
+			dirty = true;
+		}
+	}
+
+	/// Makes a component update after another, whatever their update order. Dependencies on components
+	///  that are not registered or not enabled are ignored, and components in a dependency cycle update
+	///  in update order. Takes effect at the next commit.
+	///  @component The component that updates later.
+	///  @dependency The component it depends on.
+	void addDependency(Displayable* component, Displayable* dependency)
+	{
+		Entry* entry = find(component);
+		if(entry != NULL && component != dependency &&
+			std::find(entry->dependencies.begin(), entry->dependencies.end(), dependency) == entry->dependencies.end())
+		{
+			entry->dependencies.push_back(dependency);
+			dirty = true;
+		}
+	}
+
+	/// Removes a dependency added by addDependency. Takes effect at the next commit.
+	///  @component The component that updates later.
+	///  @dependency The component it depends on.
+	void removeDependency(Displayable* component, Displayable* dependency)
+	{
+		Entry* entry = find(component);
+		if(entry == NULL)
+			return;
+
+		std::vector<Displayable*>::iterator found = std::find(entry->dependencies.begin(), entry->dependencies.end(), dependency);
+		if(found != entry->dependencies.end())
+		{
+			entry->dependencies.erase(found);
+			dirty = true;
+		}
+	}
+
+	/// Returns true if a component is updated.
+	///  @component The component.
+	///  @returns True if the component is registered and enabled, false otherwise.
+	bool isEnabled(Displayable* component)
+	{
+		Entry* entry = find(component);
+		return entry != NULL && entry->enabled;
+	}
+
+	/// Returns true if a component is drawn.
+	///  @component The component.
+	///  @returns True if the component is registered and visible, false otherwise.
+	bool isVisible(Displayable* component)
+	{
+		Entry* entry = find(component);
+		return entry != NULL && entry->visible;
+	}
+
+	/// Applies the changes made since the last commit, and rebuilds the update and draw sequences.
+	///  The components added and removed by the commit are listed until the next commit.
+	///  @returns True if any component was added or removed, false otherwise.
+	bool commit(void)
+	{
+		added.clear();
+		removed.clear();
+
+		for(size_t i = 0; i < changes.size(); i++)
+		{
+			Displayable* component = changes[i].entry.component;
+			std::map<Displayable*, int>::iterator found = indices.find(component);
+			if(changes[i].adding && found == indices.end())
+			{
+				indices[component] = (int)entries.size();
+				entries.push_back(changes[i].entry);
+				entries.back().serial = serial++;
+				added.push_back(component);
+			}
+			else if(!changes[i].adding && found != indices.end())
+			{
+				// the last entry fills the gap, as the sequences keep the order
+				int index = found->second;
+				entries[index] = entries.back();
+				indices[entries[index].component] = index;
+				entries.pop_back();
+				indices.erase(component);
+
+				// a component added and removed again before the commit was never seen by the game
+				std::vector<Displayable*>::iterator pending = std::find(added.begin(), added.end(), component);
+				if(pending != added.end())
+				{
+					added.erase(pending);
+				}
+				else
+				{
+					removed.push_back(component);
+				}
+			}
+		}
+
+		dirty = dirty || !changes.empty();
+		changes.clear();
+		if(dirty)
+		{
+			rebuild();
+		}
+
+		return !added.empty() || !removed.empty();
+	}
+
+	/// Returns the enabled components in update order, as of the last commit. Every component comes after
+	///  the components it depends on.
+	///  @returns The update sequence.
+	const std::vector<Displayable*>& getUpdateSequence(void)
+	{
+		return updates;
+	}
+
+	/// Returns the components a step of the update sequence depends on, as of the last commit.
+	///  @index The position of the component in the update sequence.
+	///  @returns The positions of its dependencies in the update sequence, all before the component.
+	const std::vector<int>& getUpdateDependencies(int index)
+	{
+		return updateDependencies[index];
+	}
+
+	/// Returns true if a step of the update sequence is parallel-safe, as of the last commit.
+	///  @index The position of the component in the update sequence.
+	///  @returns True if the component may update on a worker thread, false otherwise.
+	bool isUpdateParallel(int index)
+	{
+		return updateParallel[index];
+	}
+
+	/// Returns the number of times the sequences were rebuilt, so that anything built from them, such as
+	///  an update schedule, can tell when it is out of date.
+	///  @returns The revision of the sequences.
+	unsigned long getRevision(void)
+	{
+		return revision;
+	}
+
+	/// Returns the visible components in draw order, as of the last commit.
+	///  @returns The draw sequence.
+	const std::vector<Displayable*>& getDrawSequence(void)
+	{
+		return draws;
+	}
+
+	/// Returns every registered component in the order they were added, enabled or not.
+	///  @returns The registered components.
+	const std::vector<Displayable*>& getComponents(void)
+	{
+		return all;
+	}
+
+	/// Returns the components added by the last commit.
+	///  @returns The added components.
+	const std::vector<Displayable*>& getAdded(void)
+	{
+		return added;
+	}
+
+	/// Returns the components removed by the last commit.
+	///  @returns The removed components.
+	const std::vector<Displayable*>& getRemoved(void)
+	{
+		return removed;
+	}
+
+	/// Returns the number of registered components.
+	///  @returns The number of components.
+	int getCount(void)
+	{
+		return (int)entries.size();
+	}
+
+private:
+	/// A registered component and its keys.
+	struct Entry
+	{
+		Displayable* component;
+		int updateOrder;
+		int drawLayer;
+		unsigned long serial;
+		bool enabled;
+		bool visible;
+		bool parallel;
+		std::vector<Displayable*> dependencies;
+	};
+
+	/// A change waiting for the next commit, with the keys of an added component.
+	struct Change
+	{
+		Entry entry;
+		bool adding;
+	};
+
+	/// Orders entries by update order, then by when they were added.
+	struct UpdateBefore
+	{
+		UpdateBefore(const std::vector<Entry>& list) : entries(list) {}
+
+		bool operator()(int a, int b) const
+		{
+			if(entries[a].updateOrder != entries[b].updateOrder)
+				return entries[a].updateOrder < entries[b].updateOrder;
+			return entries[a].serial < entries[b].serial;
+		}
+
+		const std::vector<Entry>& entries;
+	};
+
+	/// Orders entries by draw layer, then by when they were added.
+	struct DrawBefore
+	{
+		DrawBefore(const std::vector<Entry>& list) : entries(list) {}
+
+		bool operator()(int a, int b) const
+		{
+			if(entries[a].drawLayer != entries[b].drawLayer)
+				return entries[a].drawLayer < entries[b].drawLayer;
+			return entries[a].serial < entries[b].serial;
+		}
+
+		const std::vector<Entry>& entries;
+	};
+
+	/// Orders entries by when they were added.
+	struct AddedBefore
+	{
+		AddedBefore(const std::vector<Entry>& list) : entries(list) {}
+
+		bool operator()(int a, int b) const
+		{
+			return entries[a].serial < entries[b].serial;
+		}
+
+		const std::vector<Entry>& entries;
+	};
+
+	/// Finds the entry of a component, as it will be after the next commit.
+	///  @component The component.
+	///  @returns The entry, or NULL if the component is not registered or is being removed.
+	Entry* find(Displayable* component)
+	{
+		for(size_t i = changes.size(); i > 0; i--)
+		{
+			if(changes[i - 1].entry.component == component)
+			{
+				return changes[i - 1].adding ? &changes[i - 1].entry : NULL;
+			}
+		}
+
+		std::map<Displayable*, int>::iterator found = indices.find(component);
+		return found != indices.end() ? &entries[found->second] : NULL;
+	}
+
+	/// Rebuilds the update, draw and registration sequences from the entries.
+	void rebuild(void)
+	{
+		std::vector<int> order(entries.size());
+		for(size_t i = 0; i < order.size(); i++)
+		{
+			order[i] = (int)i;
+		}
+
+		std::sort(order.begin(), order.end(), AddedBefore(entries));
+		all.clear();
+		for(size_t i = 0; i < order.size(); i++)
+		{
+			all.push_back(entries[order[i]].component);
+		}
+
+		std::sort(order.begin(), order.end(), UpdateBefore(entries));
+		schedule(order);
+
+		std::sort(order.begin(), order.end(), DrawBefore(entries));
+		draws.clear();
+		for(size_t i = 0; i < order.size(); i++)
+		{
+			if(entries[order[i]].visible)
+				draws.push_back(entries[order[i]].component);
+		}
+
+		revision++;
+		dirty = false;
+	}
+
+	/// Builds the update sequence: the enabled components in update order, except that a component is held
+	///  back until the components it depends on have been placed.
+	///  @order The indices of the entries in update order.
+	void schedule(const std::vector<int>& order)
+	{
+		// ranks follow the update order, and only enabled entries are ranked
+		std::vector<int> ranked;
+		std::map<Displayable*, int> ranks;
+		for(size_t i = 0; i < order.size(); i++)
+		{
+			if(entries[order[i]].enabled)
+			{
+				ranks[entries[order[i]].component] = (int)ranked.size();
+				ranked.push_back(order[i]);
+			}
+		}
+
+		std::vector<int> waiting(ranked.size(), 0);
+		std::vector< std::vector<int> > dependents(ranked.size());
+		for(size_t i = 0; i < ranked.size(); i++)
+		{
+			const std::vector<Displayable*>& dependencies = entries[ranked[i]].dependencies;
+			for(size_t j = 0; j < dependencies.size(); j++)
+			{
+				std::map<Displayable*, int>::iterator found = ranks.find(dependencies[j]);
+				if(found != ranks.end())
+				{
+					dependents[found->second].push_back((int)i);
+					waiting[i]++;
+				}
+			}
+		}
+
+		// of the components whose dependencies are placed, the first in update order is placed next
+		std::set<int> ready;
+		for(size_t i = 0; i < ranked.size(); i++)
+		{
+			if(waiting[i] == 0)
+				ready.insert((int)i);
+		}
+
+		std::vector<int> sequence;
+		std::vector<bool> placed(ranked.size(), false);
+		while(sequence.size() < ranked.size())
+		{
+			int rank;
+			if(!ready.empty())
+			{
+				rank = *ready.begin();
+				ready.erase(ready.begin());
+			}
+			else
+			{
+				// a cycle is left: its first component in update order goes next
+				rank = (int)(std::find(placed.begin(), placed.end(), false) - placed.begin());
+			}
+
+			placed[rank] = true;
+			sequence.push_back(rank);
+			for(size_t i = 0; i < dependents[rank].size(); i++)
+			{
+				int dependent = dependents[rank][i];
+				if(--waiting[dependent] == 0 && !placed[dependent])
+					ready.insert(dependent);
+			}
+		}
+
+		// dependencies are recorded as positions in the sequence, and only those placed earlier
+		std::vector<int> positions(ranked.size());
+		for(size_t i = 0; i < sequence.size(); i++)
+		{
+			positions[sequence[i]] = (int)i;
+		}
+
+		updates.clear();
+		updateParallel.clear();
+		updateDependencies.assign(sequence.size(), std::vector<int>());
+		for(size_t i = 0; i < sequence.size(); i++)
+		{
+			const Entry& entry = entries[ranked[sequence[i]]];
+			updates.push_back(entry.component);
+			updateParallel.push_back(entry.parallel);
+
+			for(size_t j = 0; j < entry.dependencies.size(); j++)
+			{
+				std::map<Displayable*, int>::iterator found = ranks.find(entry.dependencies[j]);
+				if(found != ranks.end() && positions[found->second] < (int)i)
+					updateDependencies[i].push_back(positions[found->second]);
+			}
+		}
+	}
+
+	// Registered components, and where each is stored
+	std::vector<Entry> entries;
+	std::map<Displayable*, int> indices;
+	unsigned long serial;
+
+	// Changes waiting for the next commit, and the result of the last one
+	std::vector<Change> changes;
+	std::vector<Displayable*> added;
+	std::vector<Displayable*> removed;
+	bool dirty;
+
+	// Sequences walked each frame, and how the update sequence may run in parallel
+	std::vector<Displayable*> updates;
+	std::vector< std::vector<int> > updateDependencies;
+	std::vector<bool> updateParallel;
+	unsigned long revision;
+	std::vector<Displayable*> draws;
+	std::vector<Displayable*> all;
+};
+
+#endif
@@ -0,0 +1,312 @@
+#ifndef _INCL_COMPOSITOR
+#define _INCL_COMPOSITOR
+
+/// Standard libraries
+#include <stdint.h>
+#include <vector>
+
+/// Project components
+#include "Blitter.h"
+#include "ThreadPool.h"
+
+/// Compositor
+///  Composites images and filled rectangles into a client-side 32-bit frame buffer.  Images are
+///  blended with their per-pixel alpha, or copied with a color key when one is set.
+///
+///  Draw calls are recorded into a command list and binned into screen tiles.  When the frame is
+///  rendered, the tiles are rasterized in parallel, each replaying its commands in the order they
+///  were recorded.
+class Compositor
+{
+public:
+	/// The width of a screen tile in pixels.
+	static const int TILE_WIDTH = 128;
+
+	/// The height of a screen tile in pixels.
+	static const int TILE_HEIGHT = 64;
+
+	/// Creates a new compositor drawing into the specified frame buffer.
+	///  @buffer The frame buffer pixels.
+	///  @width The width of the frame buffer.
+	///  @height The height of the frame buffer.
+	///  @stride The number of pixels between the start of two rows.
+	///  @workers The thread pool rasterizing the tiles, or NULL to rasterize on the calling thread.
+	Compositor(uint32_t* buffer, int width, int height, int stride, ThreadPool* workers)
+	{
+		pixels = buffer;
+		bufferWidth = width;
+		bufferHeight = height;
+		bufferStride = stride;
+		pool = workers;
+
+		keyed = false;
+		colorKey = 0;
+
+		tilesX = (width + TILE_WIDTH - 1) / TILE_WIDTH;
+		tilesY = (height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+		bins.resize(tilesX * tilesY);
+	}
+
+	/// Draws a region of an image into the frame buffer.
+	///  @src The image pixels, which must remain valid until the frame is rendered.
+	///  @srcStride The number of pixels between the start of two image rows.
+	///  @srcWidth The width of the image.
+	///  @srcHeight The height of the image.
+	///  @posx The x-coordinate (in image coordinates) of the region.
+	///  @posy The y-coordinate (in image coordinates) of the region.
+	///  @x The x-coordinate (in screen coordinates) to draw the region.
+	///  @y The y-coordinate (in screen coordinates) to draw the region.
+	///  @width The width of the region.
+	///  @height The height of the region.
+	void blit(const uint32_t* src, int srcStride, int srcWidth, int srcHeight, int posx, int posy, int x, int y, int width, int height)
+	{
+		// clip the region against the image
+		if(posx < 0) { x -= posx; width += posx; posx = 0; }
+		if(posy < 0) { y -= posy; height += posy; posy = 0; }
+		if(posx + width > srcWidth) { width = srcWidth - posx; }
+		if(posy + height > srcHeight) { height = srcHeight - posy; }
+
+		Command command;
+		command.type = keyed ? COMMAND_KEY : COMMAND_BLEND;
+		command.src = src;
+		command.srcStride = srcStride;
+		command.posx = posx;
+		command.posy = posy;
+		command.x = x;
+		command.y = y;
+		command.width = width;
+		command.height = height;
+		command.color = colorKey;
+
+		record(command);
+	}
+
+	/// Fills a rectangle of the frame buffer with a color.
+	///  @x The x-coordinate of the rectangle.
+	///  @y The y-coordinate of the rectangle.
+	///  @width The width of the rectangle.
+	///  @height The height of the rectangle.
+	///  @color The color to fill with.
+	void fill(int x, int y, int width, int height, uint32_t color)
+	{
+		Command command;
+		command.type = COMMAND_FILL;
+		command.src = NULL;
+		command.srcStride = 0;
+		command.posx = 0;
+		command.posy = 0;
+		command.x = x;
+		command.y = y;
+		command.width = width;
+		command.height = height;
+		command.color = color;
+
+		record(command);
+	}
+
+	/// Fills the whole frame buffer with a color.
+	///  @color The color to fill with.
+	void clear(uint32_t color)
+	{
+		fill(0, 0, bufferWidth, bufferHeight, color);
+	}
+
+	/// Rasterizes the recorded commands into the frame buffer and starts a new command list.
+	void render(void)
+	{
+		if(!commands.empty())
+		{
+			if(pool != NULL)
+			{
+				pool->parallelFor(tilesX * tilesY, [this](int tile) { renderTile(tile); });
+			}
+			else
+			{
+				for(int tile = 0; tile < tilesX * tilesY; tile++)
+				{
+					renderTile(tile);
+				}
+			}
+		}
+
+		commands.clear();
+		for(size_t i = 0; i < bins.size(); i++)
+		{
+			bins[i].clear();
+		}
+	}
+
+	/// Sets the color treated as transparent when drawing images, instead of the image alpha.
+	///  @key The transparent color.
+	void setColorKey(uint32_t key)
+	{
+		keyed = true;
+		colorKey = key & Blitter::COLOR_MASK;
+	}
+
+	/// Clears the color key, so images are blended with their alpha.
+	void clearColorKey(void)
+	{
+		keyed = false;
+	}
+
+	/// Returns the width of the frame buffer.
+	///  @returns The frame buffer width.
+	int getWidth(void)
+	{
+		return bufferWidth;
+	}
+
+	/// Returns the height of the frame buffer.
+	///  @returns The frame buffer height.
+	int getHeight(void)
+	{
+		return bufferHeight;
+	}
+
+private:
+	/// The operations a command can perform.
+	enum COMMAND_TYPE
+	{
+		COMMAND_FILL = 0,
+		COMMAND_BLEND = 1,
+		COMMAND_KEY = 2
+	};
+
+	/// A recorded draw call, already clipped to its source image and the frame buffer.
+	struct Command
+	{
+		COMMAND_TYPE type;
+		const uint32_t* src;
+		int srcStride;
+		int posx;
+		int posy;
+		int x;
+		int y;
+		int width;
+		int height;
+		uint32_t color;
+	};
+
+	/// Clips a command to the frame buffer and adds it to the bins of the tiles it touches.
+	///  @command The command to record.
+	void record(Command command)
+	{
+		if(command.x < 0) { command.posx -= command.x; command.width += command.x; command.x = 0; }
+		if(command.y < 0) { command.posy -= command.y; command.height += command.y; command.y = 0; }
+		if(command.x + command.width > bufferWidth) { command.width = bufferWidth - command.x; }
+		if(command.y + command.height > bufferHeight) { command.height = bufferHeight - command.y; }
+
+		if(command.width <= 0 || command.height <= 0)
+		{
+			return;
+		}
+
+		int index = (int)commands.size();
+		commands.push_back(command);
+
+		int left = command.x / TILE_WIDTH;
+		int top = command.y / TILE_HEIGHT;
+		int right = (command.x + command.width - 1) / TILE_WIDTH;
+		int bottom = (command.y + command.height - 1) / TILE_HEIGHT;
+
+		for(int ty = top; ty <= bottom; ty++)
+		{
+			for(int tx = left; tx <= right; tx++)
+			{
+				std::vector<int>& bin = bins[ty * tilesX + tx];
+
+				// an opaque fill over the whole tile hides everything drawn to it before
+				if(command.type == COMMAND_FILL && covers(command, tx, ty))
+				{
+					bin.clear();
+				}
+				bin.push_back(index);
+			}
+		}
+	}
+
+	/// Determines whether a command covers a whole tile.
+	bool covers(const Command& command, int tx, int ty)
+	{
+		int left = tx * TILE_WIDTH;
+		int top = ty * TILE_HEIGHT;
+		int right = left + TILE_WIDTH < bufferWidth ? left + TILE_WIDTH : bufferWidth;
+		int bottom = top + TILE_HEIGHT < bufferHeight ? top + TILE_HEIGHT : bufferHeight;
+
+		return command.x <= left && command.y <= top && command.x + command.width >= right && command.y + command.height >= bottom;
+	}
+
+	/// Replays the commands binned to a tile, clipped to the tile.
+	///  @tile The index of the tile.
+	void renderTile(int tile)
+	{
+		const std::vector<int>& bin = bins[tile];
+
+		int tileLeft = (tile % tilesX) * TILE_WIDTH;
+		int tileTop = (tile / tilesX) * TILE_HEIGHT;
+		int tileRight = tileLeft + TILE_WIDTH;
+		int tileBottom = tileTop + TILE_HEIGHT;
+
+		for(size_t i = 0; i < bin.size(); i++)
+		{
+			const Command& command = commands[bin[i]];
+
+			int left = command.x > tileLeft ? command.x : tileLeft;
+			int top = command.y > tileTop ? command.y : tileTop;
+			int right = command.x + command.width < tileRight ? command.x + command.width : tileRight;
+			int bottom = command.y + command.height < tileBottom ? command.y + command.height : tileBottom;
+
+			int width = right - left;
+			if(width <= 0 || bottom <= top)
+			{
+				continue;
+			}
+
+			uint32_t* dstRow = pixels + top * bufferStride + left;
+			const uint32_t* srcRow = NULL;
+			if(command.src != NULL)
+			{
+				srcRow = command.src + (command.posy + top - command.y) * command.srcStride + command.posx + left - command.x;
+			}
+
+			for(int row = top; row < bottom; row++)
+			{
+				switch(command.type)
+				{
+				case COMMAND_FILL:
+					Blitter::fillRow(dstRow, width, command.color);
+					break;
+				case COMMAND_BLEND:
+					Blitter::blendRow(dstRow, srcRow, width);
+					srcRow += command.srcStride;
+					break;
+				case COMMAND_KEY:
+					Blitter::keyRow(dstRow, srcRow, width, command.color);
+					srcRow += command.srcStride;
+					break;
+				}
+				dstRow += bufferStride;
+			}
+		}
+	}
+
+	// Frame buffer
+	uint32_t* pixels;
+	int bufferWidth;
+	int bufferHeight;
+	int bufferStride;
+
+	// Transparent color
+	bool keyed;
+	uint32_t colorKey;
+
+	// Recorded commands, and the commands touching each tile
+	std::vector<Command> commands;
+	std::vector< std::vector<int> > bins;
+	int tilesX;
+	int tilesY;
+	ThreadPool* pool;
+};
+
+#endif
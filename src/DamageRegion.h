@@ -0,0 +1,185 @@
+#ifndef _INCL_DAMAGEREGION
+#define _INCL_DAMAGEREGION
+
+/// Standard libraries
+#include <vector>
+
+/// X11 libraries
+#include <X11/Xlib.h>
+
+/// DamageRegion
+///	 A set of rectangles of the screen that changed during a frame.  Overlapping rectangles are merged,
+///  and a region that grows too fragmented or too large becomes the whole screen.
+class DamageRegion
+{
+public:
+	/// The number of rectangles a region may hold before it is merged into its bounding box.
+	static const int MAX_RECTANGLES = 16;
+
+	/// Creates a new empty region.
+	///  @width The width of the screen.
+	///  @height The height of the screen.
+	DamageRegion(int width, int height)
+	{
+		screenWidth = width;
+		screenHeight = height;
+		full = false;
+	}
+
+	/// Adds a rectangle to the region.
+	///  @left The left edge of the rectangle.
+	///  @top The top edge of the rectangle.
+	///  @right The right edge of the rectangle.
+	///  @bottom The bottom edge of the rectangle.
+	void add(int left, int top, int right, int bottom)
+	{
+		if(full)
+		{
+			return;
+		}
+
+		if(left < 0) left = 0;
+		if(top < 0) top = 0;
+		if(right > screenWidth) right = screenWidth;
+		if(bottom > screenHeight) bottom = screenHeight;
+		if(left >= right || top >= bottom)
+		{
+			return;
+		}
+
+		// absorb every rectangle the new one touches, until it touches none
+		Area area = { left, top, right, bottom };
+		size_t i = 0;
+		while(i < areas.size())
+		{
+			if(touches(areas[i], area))
+			{
+				area = unite(areas[i], area);
+				areas[i] = areas.back();
+				areas.pop_back();
+				i = 0;
+			}
+			else
+			{
+				i++;
+			}
+		}
+		areas.push_back(area);
+
+		if((int)areas.size() > MAX_RECTANGLES)
+		{
+			Area bounds = areas[0];
+			for(size_t j = 1; j < areas.size(); j++)
+			{
+				bounds = unite(bounds, areas[j]);
+			}
+			areas.clear();
+			areas.push_back(bounds);
+		}
+
+		// past three quarters of the screen, one full copy is cheaper than many partial ones
+		long covered = 0;
+		for(size_t j = 0; j < areas.size(); j++)
+		{
+			covered += (long)(areas[j].right - areas[j].left) * (areas[j].bottom - areas[j].top);
+		}
+		if(covered * 4 >= (long)screenWidth * screenHeight * 3)
+		{
+			setFull();
+		}
+	}
+
+	/// Adds every rectangle of another region to this region.
+	///  @other The region to add.
+	void unite(const DamageRegion& other)
+	{
+		if(other.full)
+		{
+			setFull();
+			return;
+		}
+
+		for(size_t i = 0; i < other.areas.size(); i++)
+		{
+			add(other.areas[i].left, other.areas[i].top, other.areas[i].right, other.areas[i].bottom);
+		}
+	}
+
+	/// Makes the region cover the whole screen.
+	void setFull(void)
+	{
+		full = true;
+		areas.clear();
+
+		Area screen = { 0, 0, screenWidth, screenHeight };
+		areas.push_back(screen);
+	}
+
+	/// Removes every rectangle from the region.
+	void clear(void)
+	{
+		full = false;
+		areas.clear();
+	}
+
+	/// Returns true if the region covers the whole screen, false otherwise.
+	///  @returns True if the region is full, false otherwise.
+	bool isFull(void)
+	{
+		return full;
+	}
+
+	/// Returns true if the region is empty, false otherwise.
+	///  @returns True if the region is empty, false otherwise.
+	bool isEmpty(void)
+	{
+		return areas.empty();
+	}
+
+	/// Returns the rectangles of the region.
+	///  @rects The vector to fill with the rectangles.
+	void getRectangles(std::vector<XRectangle>& rects)
+	{
+		rects.clear();
+		for(size_t i = 0; i < areas.size(); i++)
+		{
+			XRectangle rect = { (short)areas[i].left, (short)areas[i].top,
+				(unsigned short)(areas[i].right - areas[i].left), (unsigned short)(areas[i].bottom - areas[i].top) };
+			rects.push_back(rect);
+		}
+	}
+
+private:
+	/// A rectangle stored by its edges.
+	struct Area
+	{
+		int left;
+		int top;
+		int right;
+		int bottom;
+	};
+
+	/// Determines whether two rectangles overlap or share an edge.
+	static bool touches(const Area& a, const Area& b)
+	{
+		return a.left <= b.right && b.left <= a.right && a.top <= b.bottom && b.top <= a.bottom;
+	}
+
+	/// Returns the bounding box of two rectangles.
+	static Area unite(const Area& a, const Area& b)
+	{
+		Area area;
+		area.left = a.left < b.left ? a.left : b.left;
+		area.top = a.top < b.top ? a.top : b.top;
+		area.right = a.right > b.right ? a.right : b.right;
+		area.bottom = a.bottom > b.bottom ? a.bottom : b.bottom;
+		return area;
+	}
+
+	std::vector<Area> areas;
+	int screenWidth;
+	int screenHeight;
+	bool full;
+};
+
+#endif
@@ -0,0 +1,289 @@
+#ifndef _INCL_DRAWBATCH
+#define _INCL_DRAWBATCH
+
+/// Standard libraries
+#include <algorithm>
+#include <vector>
+
+/// X11 libraries
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+/// BatchCommandType
+///	 Identifies the request a batched draw call submits.
+enum BATCH_COMMAND
+{
+	/// Uploads a region of a client-side image.
+	BATCH_IMAGE = 0,
+
+	/// Copies a region of a server-side pixmap.
+	BATCH_SURFACE = 1,
+
+	/// Fills a rectangle.
+	BATCH_FILL = 2,
+
+	/// Outlines a rectangle.
+	BATCH_OUTLINE = 3,
+
+	/// Draws an outlined string.
+	BATCH_STRING = 4,
+
+	/// Draws a line segment.
+	BATCH_SEGMENT = 5,
+
+	/// Clears the frame. Only recorded into frame snapshots.
+	BATCH_CLEAR = 6
+};
+
+/// BatchCommand
+///	 A draw call recorded with all of the graphics context state it needs.
+struct BatchCommand
+{
+	BATCH_COMMAND type;
+	GC gc;
+
+	// Source of image commands; posx and posy are the end point of segment commands
+	XImage* image;
+	Drawable surface;
+	int posx;
+	int posy;
+
+	// Clip mask and its origin, or None
+	Pixmap mask;
+	int originX;
+	int originY;
+
+	// Destination
+	int x;
+	int y;
+	int width;
+	int height;
+	unsigned long colour;
+
+	// Text of string commands, in the batch text buffer
+	int text;
+	int length;
+
+	// Screen area touched by the command
+	int left;
+	int top;
+	int right;
+	int bottom;
+
+	// Position in submission order
+	int layer;
+	int order;
+};
+
+/// DrawBatch
+///	 Records draw calls and sorts them so that calls sharing graphics context state are submitted
+///  together.  Calls are only moved past calls they do not overlap, so the result on screen is the
+///  same as drawing them in the order they were recorded.
+///
+///  A batch also holds the snapshot of a frame recorded by XInfo::beginRecording, in recording order.
+class DrawBatch
+{
+public:
+	/// Adds a command to the batch.
+	///  @command The command to add. Its bounds must be set.
+	void add(BatchCommand command)
+	{
+		command.order = (int)commands.size();
+		command.layer = 0;
+		command.text = 0;
+		command.length = 0;
+		commands.push_back(command);
+	}
+
+	/// Adds a string command to the batch.
+	///  @command The command to add. Its bounds must be set.
+	///  @str The text of the command.
+	///  @length The length of the text.
+	void add(BatchCommand command, const char* str, int length)
+	{
+		add(command);
+		commands.back().text = (int)text.size();
+		commands.back().length = length;
+		text.insert(text.end(), str, str + length);
+	}
+
+	/// Sorts the commands by graphics context state.
+	void sort(void)
+	{
+		// A command must follow every earlier command it overlaps and cannot share a submission with,
+		// so it is placed one layer above them. Independent commands share a layer and are grouped.
+		// Rather than testing every pair, the area of the batch is divided into a coarse grid, each cell
+		// keeping the highest layer drawn into it; a command sharing a cell counts as overlapping it,
+		// which can only raise a layer, never break the order.
+		if(commands.empty())
+		{
+			return;
+		}
+
+		int left = commands[0].left, top = commands[0].top;
+		int right = commands[0].right, bottom = commands[0].bottom;
+		for(size_t i = 1; i < commands.size(); i++)
+		{
+			left = std::min(left, commands[i].left);
+			top = std::min(top, commands[i].top);
+			right = std::max(right, commands[i].right);
+			bottom = std::max(bottom, commands[i].bottom);
+		}
+
+		gridLeft = left;
+		gridTop = top;
+		cellWidth = std::max(MIN_CELL_SIZE, (right - left + GRID_CELLS - 1) / GRID_CELLS);
+		cellHeight = std::max(MIN_CELL_SIZE, (bottom - top + GRID_CELLS - 1) / GRID_CELLS);
+		gridColumns = std::max((right - left + cellWidth - 1) / cellWidth, 1);
+		gridRows = std::max((bottom - top + cellHeight - 1) / cellHeight, 1);
+
+		Cell empty = { -1, -1, true };
+		cells.assign(gridColumns * gridRows, empty);
+
+		for(size_t i = 0; i < commands.size(); i++)
+		{
+			BatchCommand& command = commands[i];
+			int firstColumn, firstRow, lastColumn, lastRow;
+			span(command, firstColumn, firstRow, lastColumn, lastRow);
+
+			for(int row = firstRow; row <= lastRow; row++)
+			{
+				for(int column = firstColumn; column <= lastColumn; column++)
+				{
+					const Cell& cell = cells[row * gridColumns + column];
+					if(cell.top < 0)
+					{
+						continue;
+					}
+
+					// the command may share the top layer of the cell only if nothing on it conflicts with it
+					bool shared = cell.uniform && !conflicts(commands[cell.top], command);
+					int layer = shared ? cell.layer : cell.layer + 1;
+					if(layer > command.layer)
+					{
+						command.layer = layer;
+					}
+				}
+			}
+
+			for(int row = firstRow; row <= lastRow; row++)
+			{
+				for(int column = firstColumn; column <= lastColumn; column++)
+				{
+					Cell& cell = cells[row * gridColumns + column];
+					if(cell.top < 0 || command.layer > cell.layer)
+					{
+						cell.layer = command.layer;
+						cell.top = (int)i;
+						cell.uniform = true;
+					}
+					else if(command.layer == cell.layer && conflicts(commands[cell.top], command))
+					{
+						cell.uniform = false;
+					}
+				}
+			}
+		}
+
+		std::sort(commands.begin(), commands.end(), compare);
+	}
+
+	/// Removes every command from the batch.
+	void clear(void)
+	{
+		commands.clear();
+		text.clear();
+	}
+
+	/// Returns the number of commands in the batch.
+	///  @returns The number of commands.
+	int getCount(void)
+	{
+		return (int)commands.size();
+	}
+
+	/// Returns a command of the batch.
+	///  @index The index of the command.
+	///  @returns The command.
+	BatchCommand& get(int index)
+	{
+		return commands[index];
+	}
+
+	/// Returns the text of a string command.
+	///  @command The string command.
+	///  @returns The text, which is not null terminated.
+	const char* getText(const BatchCommand& command)
+	{
+		return &text[command.text];
+	}
+
+	/// Determines whether two commands use the same graphics context state.
+	///  @a A command.
+	///  @b A command.
+	///  @returns True if the commands share state, false otherwise.
+	static bool sameState(const BatchCommand& a, const BatchCommand& b)
+	{
+		return a.type == b.type && a.gc == b.gc && a.image == b.image && a.surface == b.surface
+			&& a.mask == b.mask && a.colour == b.colour;
+	}
+
+private:
+	/// The number of grid cells along each side of the area of a batch, at most.
+	static const int GRID_CELLS = 64;
+
+	/// The smallest side of a grid cell, in pixels.
+	static const int MIN_CELL_SIZE = 16;
+
+	/// A cell of the layering grid: the highest layer drawn into it, a command on that layer, and
+	///  whether every command on that layer drawn into the cell shares a submission with it.
+	struct Cell
+	{
+		int layer;
+		int top;
+		bool uniform;
+	};
+
+	/// Finds the grid cells a command covers. A command without area still covers the cell it lies in.
+	void span(const BatchCommand& command, int& firstColumn, int& firstRow, int& lastColumn, int& lastRow)
+	{
+		firstColumn = std::min((command.left - gridLeft) / cellWidth, gridColumns - 1);
+		firstRow = std::min((command.top - gridTop) / cellHeight, gridRows - 1);
+		lastColumn = std::min((std::max(command.right - 1, command.left) - gridLeft) / cellWidth, gridColumns - 1);
+		lastRow = std::min((std::max(command.bottom - 1, command.top) - gridTop) / cellHeight, gridRows - 1);
+	}
+
+	/// Determines whether two overlapping commands must stay in separate submissions.
+	static bool conflicts(const BatchCommand& a, const BatchCommand& b)
+	{
+		// strings draw their outlines and fills in separate passes, so even equal strings are kept apart
+		return !sameState(a, b) || a.type == BATCH_STRING;
+	}
+
+	/// Orders commands by layer, then state, then recording order.
+	static bool compare(const BatchCommand& a, const BatchCommand& b)
+	{
+		if(a.layer != b.layer) return a.layer < b.layer;
+		if(a.type != b.type) return a.type < b.type;
+		if(a.gc != b.gc) return a.gc < b.gc;
+		if(a.surface != b.surface) return a.surface < b.surface;
+		if(a.image != b.image) return a.image < b.image;
+		if(a.mask != b.mask) return a.mask < b.mask;
+		if(a.colour != b.colour) return a.colour < b.colour;
+		return a.order < b.order;
+	}
+
+	std::vector<BatchCommand> commands;
+	std::vector<char> text;
+
+	// Layering grid, reused by every sort
+	std::vector<Cell> cells;
+	int gridLeft;
+	int gridTop;
+	int gridColumns;
+	int gridRows;
+	int cellWidth;
+	int cellHeight;
+};
+
+#endif
@@ -3,7 +3,7 @@
 
 /// Standard libraries
 #include <iostream>
-#include <list>
+#include <vector>
 #include <cstdlib>
 #include <sys/time.h>
 #include <math.h>
@@ -11,6 +11,9 @@
 #include <string>
 #include <cstring>
 #include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 /// X11 libraries
 #include <X11/Xlib.h>
@@ -22,6 +25,9 @@
 #include "MouseState.h"
 #include "XInfo.h"
 #include "Displayable.h"
+#include "ComponentRegistry.h"
+#include "JobSystem.h"
+#include "ThreadPool.h"
 #include "GameTime.h"
 #include "Logger.h"
 #include "Constants.h"
@@ -61,80 +67,71 @@ public:
 	///  @gameTime Time elapsed since the last call to draw.
 	virtual void handleSystemInput(XInfo* xinfo, GameTime* gameTime) = 0;
 
+	/// Draws the loading screen while requested assets load in the background. Called repeatedly by
+	///  game_load; the default draws nothing.
+	///  @xinfo The graphics information for game.
+	///  @progress The share of requested assets loaded so far, from 0 to 1.
+	virtual void loading(XInfo*, double)
+	{
+	}
+
 	/// Call this method to initialize the game, begin running the game loop, and start processing events for the game.
 	///  @xinfo The graphics information for game.	
 	void run(XInfo* xinfo)
 	{
-		XEvent event;
-
-		int inside = 0;
 		gameRunning = true;
 
-		unsigned long gameStart = GameTime::getNow();
-		unsigned long prevTime = GameTime::getNow();
-		Display* dply = xinfo->getDisplay();
-
 		Logger::application_debug(Logger::LOG_GAMEINIT);
 		game_initialize(xinfo);
 		Logger::application_debug(Logger::LOG_TASKDONE);
 
+		// the window is shown first, so a loading screen can be drawn while assets load
+		xinfo->openw();
+
 		// load assets from each component
 		Logger::application_debug(Logger::LOG_ASSETLOADING);	
 		game_load(xinfo);
 		Logger::application_debug(Logger::LOG_ASSETLOADED);
 
-		xinfo->openw();
+		// the clock starts once loading is done, so the first frame does not absorb the load time
+		gameTime.reset(GameTime::getNow());
+		simulationTime.reset(gameTime.getCurrentTime());
+		accumulator = 0;
 
 		Logger::application_debug(Logger::LOG_GAMESTART);
+		// the pipelined loop returns once the game stops running
+		if(pipelined)
+		{
+			game_pipeline(xinfo);
+		}
+
 		while(gameRunning)
 		{
-			GameTime* gameTime = new GameTime(prevTime, gameStart);
+			gameTime.update();
+
+			// components added or removed during the last frame join or leave here
+			game_commit(xinfo);
+
 			// handle all the events currently in the queue
+			handleEvents(xinfo);
 
-			// Although this could possibly block (unending event list) it is
-			// unlikely and more of a stress case than a real world scenario
-			// At least for the purposes of this assignment
-			while(XPending(dply) > 0)
+			if(fixedTimeStep)
 			{
-				XNextEvent(dply, &event);
-				switch(event.type)
-				{
-				case KeyRelease:
-					handleKeyRelease(xinfo, &event);
-					break;
-				case KeyPress:
-					handleKeyPress(xinfo, &event);
-					break;
-				case MotionNotify:
-					handleMotion(xinfo, &event, inside);
-					break;
-				case EnterNotify:
-					inside = 1;
-					break;
-				case LeaveNotify:
-					inside = 0;
-					break;
-				case ConfigureNotify:
-					handleResize(xinfo, &event);
-					break;
-				}
+				game_step(xinfo, &gameTime);
 			}
+			else
+			{
+				// sleep	
+				xinfo->wait(FPS_COEFFICIENT / fps);
 
-			// sleep	
-			xinfo->wait(FPS_COEFFICIENT / fps);
-
-			game_update(xinfo, gameTime);
-			game_draw(xinfo, gameTime);
-
-			// flush buffer to display
-			xinfo->flush();
-
-			// record previous time for game time object
-			prevTime = gameTime->getCurrentTime();
+				game_update(xinfo, &gameTime);
+				game_draw(xinfo, &gameTime);
 
-			handleSystemInput(xinfo, gameTime);
+				// flush buffer to display
+				xinfo->flush();
+			}
 
-			free(gameTime);
+			handleSystemInput(xinfo, &gameTime);
 		}
 		Logger::application_debug(Logger::LOG_GAMEEND);
 
@@ -143,7 +140,10 @@ public:
 		game_unload(xinfo);
 		Logger::application_debug(Logger::LOG_ASSETRELEASED);
 
-		XCloseDisplay(xinfo->getDisplay());
+		delete jobs;
+		jobs = NULL;
+
+		xinfo->close();
 	}
 
 	/// Setting properties in the game.
@@ -178,16 +178,258 @@ public:
 		fps = value;
 	}
 
-	/// Adds a Displayable component to the game.
+	/// Returns true if the game updates at a fixed rate, false otherwise.
+	///  @returns True if fixed timestep is enabled, false otherwise.
+	bool isFixedTimeStep(void)
+	{
+		return fixedTimeStep;
+	}
+
+	/// Sets whether the simulation runs in fixed steps of 1/fps seconds. Rendering is then decoupled
+	///  from the simulation and receives an interpolation factor through GameTime.
+	///  @value The value to set.
+	void setFixedTimeStep(bool value)
+	{
+		fixedTimeStep = value;
+	}
+
+	/// Returns the maximum number of frames drawn per second in fixed timestep mode.
+	///  @returns The render frame limit, 0 if unlimited.
+	int getRenderFps(void)
+	{
+		return renderFps;
+	}
+
+	/// Sets the maximum number of frames drawn per second in fixed timestep mode.
+	///  @value The value to set, 0 to draw as often as possible.
+	void setRenderFps(int value)
+	{
+		renderFps = value;
+	}
+
+	/// Returns true if the next frame is simulated while the last one is drawn, false otherwise.
+	///  @returns True if the game loop is pipelined, false otherwise.
+	bool isPipelined(void)
+	{
+		return pipelined;
+	}
+
+	/// Sets whether the next frame is simulated on a second thread while the last one is drawn, so that a
+	///  frame takes about the longer of the two rather than their sum, at the cost of one frame of latency.
+	///  Must be called before run.
+	///
+	///  The simulation thread updates the components, then draws them into a snapshot recorded by XInfo
+	///  instead of the screen. This thread presents the previous snapshot meanwhile, and handles events,
+	///  system input and component changes between frames while the simulation thread waits. Components
+	///  must therefore only draw through XInfo, and must not send requests to the display directly from
+	///  draw or update.
+	///  @value The value to set.
+	void setPipelined(bool value)
+	{
+		pipelined = value;
+	}
+
+	/// Returns the number of worker threads updating parallel-safe components.
+	///  @returns The number of worker threads, or -1 to use one per core but the first.
+	int getUpdateThreads(void)
+	{
+		return updateThreads;
+	}
+
+	/// Sets the number of worker threads updating parallel-safe components, in addition to the calling
+	///  thread. The workers are started when a component is first marked parallel-safe, so this must be
+	///  called before then.
+	///  @value The number of worker threads, 0 to update every component on the calling thread, or -1 to
+	///   use one per core but the first.
+	void setUpdateThreads(int value)
+	{
+		updateThreads = value;
+	}
+
+	/// Adds a Displayable component to the game, updated and drawn after the components added before it.
+	///  The component joins the game at the next frame boundary, and is initialized and loaded then if
+	///  the game is already running.
 	///  @displayable The component to add to the game.
 	void addComponent(Displayable* displayable)
 	{
-		// when a component is added, it is then called in the game_ methods.
-		components.push_front(displayable);
+		components.add(displayable);
+	}
+
+	/// Adds a Displayable component to the game with explicit ordering keys.
+	///  @displayable The component to add to the game.
+	///  @updateOrder The update order key; lower keys update first.
+	///  @drawLayer The draw layer key; lower layers are drawn first, under higher ones.
+	void addComponent(Displayable* displayable, int updateOrder, int drawLayer)
+	{
+		components.add(displayable, updateOrder, drawLayer);
+	}
+
+	/// Removes a Displayable component from the game at the next frame boundary, unloading it if it was
+	///  loaded. The component is not deleted.
+	///  @displayable The component to remove from the game.
+	void removeComponent(Displayable* displayable)
+	{
+		components.remove(displayable);
+	}
+
+	/// Returns the registry of components, to enable, hide or reorder them.
+	///  @returns The component registry.
+	ComponentRegistry* getComponents(void)
+	{
+		return &components;
 	}
 
 private:
 	static const unsigned long FPS_COEFFICIENT = 1000000;
+	static const long long TICKS_PER_MICROSECOND = 1000;
+
+	/// The longest time the loading screen waits for an asset before it is drawn again, in microseconds.
+	static const long LOADING_INTERVAL = 16000;
+
+	/// The maximum number of simulation steps run before a frame is drawn.
+	static const long long MAX_FRAMESKIP = 5;
+
+	/// Runs every simulation step that is due, then draws a single frame interpolated between steps.
+	void game_step(XInfo* xinfo, GameTime* gameTime)
+	{
+		game_advance(xinfo, gameTime);
+		game_draw(xinfo, gameTime);
+
+		// flush buffer to display
+		xinfo->flush();
+
+		game_limit(xinfo, gameTime);
+	}
+
+	/// Runs every simulation step that is due, and sets the interpolation of the frame between steps.
+	void game_advance(XInfo* xinfo, GameTime* gameTime)
+	{
+		long long step = GameTime::TICKS_PER_SECOND / fps;
+		accumulator += gameTime->getElapsedTime();
+
+		// drop simulation time we can never catch up on, rather than spiral further behind
+		if(accumulator > step * MAX_FRAMESKIP)
+		{
+			accumulator = step * MAX_FRAMESKIP;
+		}
+
+		while(accumulator >= step)
+		{
+			simulationTime.advance(simulationTime.getCurrentTime() + step);
+			game_update(xinfo, &simulationTime);
+
+			accumulator -= step;
+		}
+
+		gameTime->setInterpolation((float)((double)accumulator / step));
+	}
+
+	/// Sleeps only for what is left of the render frame budget.
+	void game_limit(XInfo* xinfo, GameTime* gameTime)
+	{
+		if(renderFps > 0)
+		{
+			long long budget = GameTime::TICKS_PER_SECOND / renderFps;
+			long long spent = GameTime::getNow() - gameTime->getCurrentTime();
+			if(spent < budget)
+			{
+				xinfo->wait((budget - spent) / TICKS_PER_MICROSECOND);
+			}
+		}
+	}
+
+	/// Runs the game loop with the simulation of each frame on a second thread, while this thread presents
+	///  the frame simulated before it. Events, system input and component changes are handled between
+	///  frames, while the simulation thread waits.
+	void game_pipeline(XInfo* xinfo)
+	{
+		std::thread simulation(&Game::game_simulation, this, xinfo);
+
+		int front = 0;
+		bool recorded = false;
+		while(gameRunning)
+		{
+			gameTime.update();
+			game_commit(xinfo);
+			handleEvents(xinfo);
+			handleSystemInput(xinfo, &gameTime);
+
+			if(!fixedTimeStep)
+			{
+				xinfo->wait(FPS_COEFFICIENT / fps);
+			}
+
+			// the next frame is recorded into the back snapshot while the front one is presented
+			{
+				std::lock_guard<std::mutex> lock(pipelineMutex);
+				pipelineTarget = 1 - front;
+			}
+			pipelineWake.notify_one();
+
+			if(recorded)
+			{
+				xinfo->presentSnapshot(&snapshots[front]);
+				if(fixedTimeStep)
+				{
+					game_limit(xinfo, &gameTime);
+				}
+			}
+
+			{
+				std::unique_lock<std::mutex> lock(pipelineMutex);
+				pipelineDone.wait(lock, [this] { return pipelineTarget < 0; });
+			}
+			front = 1 - front;
+			recorded = true;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(pipelineMutex);
+			pipelineStopping = true;
+		}
+		pipelineWake.notify_one();
+		simulation.join();
+
+		// the last snapshot is never presented, so what it kept alive is released now
+		xinfo->releaseRetired();
+	}
+
+	/// The simulation thread loop: updates the components and records a snapshot of them each time this
+	///  thread is given one.
+	void game_simulation(XInfo* xinfo)
+	{
+		std::unique_lock<std::mutex> lock(pipelineMutex);
+		while(true)
+		{
+			pipelineWake.wait(lock, [this] { return pipelineStopping || pipelineTarget >= 0; });
+			if(pipelineStopping)
+			{
+				return;
+			}
+
+			DrawBatch* snapshot = &snapshots[pipelineTarget];
+			lock.unlock();
+
+			// the update records as well, so the resources and colors it sets wait for the snapshot
+			// being presented on the other thread instead of racing it on the display
+			xinfo->beginRecording(snapshot);
+			if(fixedTimeStep)
+			{
+				game_advance(xinfo, &gameTime);
+			}
+			else
+			{
+				game_update(xinfo, &gameTime);
+			}
+
+			game_draw(xinfo, &gameTime);
+			xinfo->endRecording();
+
+			lock.lock();
+			pipelineTarget = -1;
+			pipelineDone.notify_one();
+		}
+	}
 
 	/// Draws the Game component to the screen.
 	void game_draw(XInfo* xinfo, GameTime* gameTime)
@@ -196,14 +438,10 @@ private:
 
 		draw(xinfo, gameTime);
 
-		list<Displayable *>::const_iterator begin = components.begin();
-		list<Displayable *>::const_iterator end = components.end();
-
-		while( begin != end )
+		const vector<Displayable*>& sequence = components.getDrawSequence();
+		for(size_t i = 0; i < sequence.size(); i++)
 		{
-			Displayable *d = *begin;
-			d->draw(xinfo, gameTime);
-			begin++;
+			sequence[i]->draw(xinfo, gameTime);
 		}
 	}
 
@@ -212,14 +450,90 @@ private:
 	{
 		update(xinfo, gameTime);
 
-		list<Displayable*>::const_iterator begin = components.begin();
-		list<Displayable*>::const_iterator end = components.end();
+		if(components.getRevision() != scheduled)
+		{
+			game_schedule();
+		}
+
+		if(parallelUpdate)
+		{
+			updateInfo = xinfo;
+			updateTime = gameTime;
+			jobs->run();
+			return;
+		}
 
-		while(begin != end)
+		const vector<Displayable*>& sequence = components.getUpdateSequence();
+		for(size_t i = 0; i < sequence.size(); i++)
 		{
-			Displayable *d = *begin;		
-			d->update(xinfo, gameTime);
-			begin++;
+			sequence[i]->update(xinfo, gameTime);
+		}
+	}
+
+	/// Builds the job graph of the update sequence. Parallel-safe components run on any thread once their
+	///  dependencies have updated; every other component runs on this thread, after every component before
+	///  it in the sequence and before every component after it.
+	void game_schedule(void)
+	{
+		scheduled = components.getRevision();
+
+		const vector<Displayable*>& sequence = components.getUpdateSequence();
+		parallelUpdate = false;
+		for(size_t i = 0; i < sequence.size(); i++)
+		{
+			parallelUpdate = parallelUpdate || components.isUpdateParallel((int)i);
+		}
+
+		if(updateThreads == 0 || !parallelUpdate)
+		{
+			parallelUpdate = false;
+			return;
+		}
+
+		if(jobs == NULL)
+		{
+			jobs = new JobSystem(updateThreads < 0 ? ThreadPool::getDefaultWorkers() : updateThreads);
+		}
+		jobs->clear();
+
+		// jobs are added in sequence order, so a job index is also the position of its component
+		int barrier = -1;
+		vector<int> group;
+		for(size_t i = 0; i < sequence.size(); i++)
+		{
+			Displayable* component = sequence[i];
+			bool parallel = components.isUpdateParallel((int)i);
+			int job = jobs->add([this, component] { component->update(updateInfo, updateTime); }, !parallel);
+
+			if(parallel)
+			{
+				// dependencies before the last barrier have already run by the time the barrier has
+				if(barrier >= 0)
+				{
+					jobs->depend(job, barrier);
+				}
+
+				const vector<int>& dependencies = components.getUpdateDependencies((int)i);
+				for(size_t j = 0; j < dependencies.size(); j++)
+				{
+					if(dependencies[j] > barrier)
+						jobs->depend(job, dependencies[j]);
+				}
+				group.push_back(job);
+			}
+			else
+			{
+				if(group.empty() && barrier >= 0)
+				{
+					jobs->depend(job, barrier);
+				}
+				for(size_t j = 0; j < group.size(); j++)
+				{
+					jobs->depend(job, group[j]);
+				}
+				group.clear();
+				barrier = job;
+			}
 		}
 	}
 
@@ -228,29 +542,32 @@ private:
 	{
 		load(xinfo);
 
-		list<Displayable*>::const_iterator begin = components.begin();
-		list<Displayable*>::const_iterator end = components.end();
+		// components added by the game while loading are initialized before any component loads
+		game_commit(xinfo);
 
-		while( begin != end )
+		const vector<Displayable*>& all = components.getComponents();
+		for(size_t i = 0; i < all.size(); i++)
 		{
-			Displayable *d = *begin;
-			d->load(xinfo);
-			begin++;
+			all[i]->load(xinfo);
+		}
+		loaded = true;
+
+		// images requested by the components decode on worker threads, and are created here as they finish
+		while(xinfo->updateLoading(LOADING_INTERVAL) > 0)
+		{
+			loading(xinfo, xinfo->getLoadProgress());
 		}
 	}
 
 	/// Disposes all data that was loaded by this Game.
 	void game_unload(XInfo* xinfo)
 	{
-		list<Displayable*>::const_iterator begin = components.begin();
-		list<Displayable*>::const_iterator end = components.end();
-
-		while( begin != end )
+		const vector<Displayable*>& all = components.getComponents();
+		for(size_t i = 0; i < all.size(); i++)
 		{
-			Displayable *d = *begin;
-			d->unload(xinfo); 
-			begin++;
+			all[i]->unload(xinfo);
 		}
+		loaded = false;
 
 		unload(xinfo);
 	}
@@ -262,14 +579,85 @@ private:
 
 		initialize(xinfo); 
 
-		list<Displayable*>::const_iterator begin = components.begin();
-		list<Displayable*>::const_iterator end = components.end();
+		components.commit();
+		const vector<Displayable*>& all = components.getComponents();
+		for(size_t i = 0; i < all.size(); i++)
+		{
+			all[i]->initialize(xinfo);
+		}
+	}
+
+	/// Applies the component changes made since the last frame. Components that join a game already
+	///  initialized are initialized, and loaded if the game is loaded; components that leave are unloaded.
+	///  Images requested after loading, such as by components joining later, are created as they finish.
+	void game_commit(XInfo* xinfo)
+	{
+		if(loaded && xinfo->isLoading())
+		{
+			xinfo->updateLoading(0);
+		}
 
-		while(begin != end)
+		if(!components.commit())
 		{
-			Displayable *d = *begin;
-			d->initialize(xinfo);
-			begin++;
+			return;
+		}
+
+		const vector<Displayable*>& removed = components.getRemoved();
+		for(size_t i = 0; i < removed.size(); i++)
+		{
+			if(loaded)
+			{
+				removed[i]->unload(xinfo);
+			}
+		}
+
+		const vector<Displayable*>& added = components.getAdded();
+		for(size_t i = 0; i < added.size(); i++)
+		{
+			added[i]->initialize(xinfo);
+			if(loaded)
+			{
+				added[i]->load(xinfo);
+			}
+		}
+	}
+
+	/// Handles all the events currently in the queue.
+	void handleEvents(XInfo* xinfo)
+	{
+		XEvent event;
+		Display* dply = xinfo->getDisplay();
+
+		// Although this could possibly block (unending event list) it is
+		// unlikely and more of a stress case than a real world scenario
+		// At least for the purposes of this assignment
+		while(XPending(dply) > 0)
+		{
+			XNextEvent(dply, &event);
+			switch(event.type)
+			{
+			case KeyRelease:
+				handleKeyRelease(xinfo, &event);
+				break;
+			case KeyPress:
+				handleKeyPress(xinfo, &event);
+				break;
+			case MotionNotify:
+				handleMotion(xinfo, &event, inside);
+				break;
+			case EnterNotify:
+				inside = 1;
+				break;
+			case LeaveNotify:
+				inside = 0;
+				break;
+			case ConfigureNotify:
+				handleResize(xinfo, &event);
+				break;
+			case Expose:
+				handleExpose(xinfo, &event);
+				break;
+			}
 		}
 	}
 
@@ -283,6 +671,16 @@ private:
 		}
 	}
 
+	/// Handles the window expose event.
+	void handleExpose(XInfo* xinfo, XEvent* event)
+	{
+		// uncovered parts of the window are only redrawn when damaged, so the next frame is presented in full
+		if(event->xexpose.count == 0)
+		{
+			xinfo->invalidate();
+		}
+	}
+
 	/// Handles the window resize event.
 	void handleResize(XInfo* xinfo, XEvent* event)
 	{
@@ -296,6 +694,9 @@ private:
 
 			pix->setPoint(xDiff / 2, yDiff / 2);
 		}
+
+		// the window contents are lost or moved, so the next frame is presented in full
+		xinfo->invalidate();
 	}
 
 	/// Handles a keyboard key press event.
@@ -312,7 +713,7 @@ private:
 		xinfo->getKeyboardState()->clear((KEYS)kEvent->keycode);
 	}
 
-	std::list<Displayable*> components;
+	ComponentRegistry components;
 	int fps;
 	int border;
 	int buffersize;
@@ -320,6 +721,38 @@ private:
 	int windowWidth;
 	int windowHeight;
 	bool gameRunning;
+
+	/// Game clocks, reused every frame
+	GameTime gameTime;
+	GameTime simulationTime;
+
+	/// Fixed timestep state
+	bool fixedTimeStep = false;
+	int renderFps = 0;
+	long long accumulator = 0;
+
+	/// True while the components are loaded
+	bool loaded = false;
+
+	/// Parallel update state, and the arguments of the update being run
+	JobSystem* jobs = NULL;
+	int updateThreads = -1;
+	unsigned long scheduled = 0;
+	bool parallelUpdate = false;
+	XInfo* updateInfo = NULL;
+	GameTime* updateTime = NULL;
+
+	/// True while the pointer is inside the window
+	int inside = 0;
+
+	/// Pipelined game loop: the snapshots recorded by the simulation thread, and the one it is recording
+	bool pipelined = false;
+	DrawBatch snapshots[2];
+	std::mutex pipelineMutex;
+	std::condition_variable pipelineWake;
+	std::condition_variable pipelineDone;
+	int pipelineTarget = -1;
+	bool pipelineStopping = false;
 };
 
 #endif
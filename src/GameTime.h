@@ -3,92 +3,149 @@
 
 /// Standard libraries
 #include <stdio.h>
-#include <sys/time.h>
+#include <time.h>
 
 /// Project components
 #include "Constants.h"
 
 /// GameTime
 ///	 The GameTime class is designed to store information about time relating to the frames drawn.  It provides
-///	 details such as time elapsed since last update or the current frame time.
+///	 details such as time elapsed since last update or the current frame time.  All clock values are
+///	 nanosecond ticks of a monotonic clock, so they are unaffected by changes to the wall clock.
 class GameTime
 {
 public:
-	/// Creates a new instance of GameTime.
+	/// The number of clock ticks in a second.
+	static const long long TICKS_PER_SECOND = 1000000000LL;
+
+	/// The number of clock ticks in a millisecond.
+	static const long long TICKS_PER_MILLISECOND = 1000000LL;
+
+	/// Creates a new instance of GameTime starting at the current clock time.
 	GameTime(void)
 	{
-		unsigned long now = getNow();
-		_now = now;
-		_prev = now;
+		reset(getNow());
+	}
+
+	/// Creates a new instance of GameTime for an explicit step.
+	///  @currentTime The clock time of the step.
+	///  @previousTime The clock time of the previous step.
+	///  @startTime The clock time at the start of the game.
+	GameTime(long long currentTime, long long previousTime, long long startTime)
+	{
+		_start = startTime;
+		_prev = previousTime;
+		_now = currentTime;
+		_elapsed = _now - _prev;
+		_interpolation = 1.0f;
+	}
 
-		_totalGametime = 0;
+	/// Restarts the game time at the specified clock time.
+	///  @time The clock time at the start of the game.
+	void reset(long long time)
+	{
+		_start = time;
+		_prev = time;
+		_now = time;
 		_elapsed = 0;
+		_interpolation = 1.0f;
 	}
 
-	/// Creates a new instance of GameTime.
-	///  @previousTime The elapsed game time since the last update.
-	///  @totalGameTime The amount of game time since the start of the game. 
-	GameTime(unsigned long previousTime, unsigned long totalGameTime)
+	/// Samples the clock and advances the game time to the current time.
+	void update(void)
 	{
-		_now = getNow();
-		_prev = previousTime;
+		advance(getNow());
+	}
 
-		_elapsed = (_now - _prev);
-		_totalGametime = totalGameTime;
+	/// Advances the game time to the specified clock time.
+	///  @time The new current clock time.
+	void advance(long long time)
+	{
+		_prev = _now;
+		_now = time;
+		_elapsed = _now - _prev;
 	}
 
 	/// Gets the current clock time.
-	///  @returns The current time value.
-	unsigned long getCurrentTime(void)
+	///  @returns The current time value in ticks.
+	long long getCurrentTime(void)
 	{
 		return _now;
 	}
 
 	/// The amount of elapsed game time since the last update.
-	///  @returns The elapsed game time.
-	unsigned long getElapsedTime(void)
+	///  @returns The elapsed game time in ticks.
+	long long getElapsedTime(void)
 	{
 		return _elapsed;
 	}
 
-	/// The clock time at the start of the game.
-	///  @returns The total game time.
-	unsigned long getTotalTime(void)
+	/// The amount of game time since the start of the game.
+	///  @returns The total game time in ticks.
+	long long getTotalTime(void)
 	{
-		return _totalGametime;
+		return _now - _start;
 	}
 
 	/// Gets the timestamp associated with the previous frame.
 	///  @returns The previous frame clock time.
-	unsigned long getPreviousTime(void)
+	long long getPreviousTime(void)
 	{
 		return _prev;
 	}
 
 	/// Gets the elapsed time as a computed millisecond format.
 	///  @returns The elapsed delta component.
-	float getElapsedDelta(void)
+	double getElapsedDelta(void)
+	{
+		return ((double)_elapsed / TICKS_PER_MILLISECOND) / Constants::TIME_DIVISOR;
+	}
+
+	/// Gets the amount of elapsed game time since the last update in seconds.
+	///  @returns The elapsed game time in seconds.
+	double getElapsedSeconds(void)
+	{
+		return (double)_elapsed / TICKS_PER_SECOND;
+	}
+
+	/// Gets the amount of game time since the start of the game in seconds.
+	///  @returns The total game time in seconds.
+	double getTotalSeconds(void)
+	{
+		return (double)(_now - _start) / TICKS_PER_SECOND;
+	}
+
+	/// Gets the fraction of a simulation step that has passed since the last update, in the range [0, 1].
+	///  Drawing code can blend between the previous and current state with this value.
+	///  @returns The render interpolation factor.
+	float getInterpolation(void)
+	{
+		return _interpolation;
+	}
+
+	/// Sets the fraction of a simulation step that has passed since the last update.
+	///  @value The value to set.
+	void setInterpolation(float value)
 	{
-		return (float)_elapsed / Constants::TIME_DIVISOR;
+		_interpolation = value;
 	}
 
-	/// Get the current time in microseconds.
-	///  @returns The time value in microseconds.
-	static unsigned long getNow()
+	/// Get the current time of the monotonic clock.
+	///  @returns The time value in nanosecond ticks.
+	static long long getNow()
 	{
-		timeval tv;
-		gettimeofday(&tv, 0);
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
 
-		// Gets the current seconds * 1000 + microseconds / 1000
-		unsigned long time = tv.tv_sec * 1000 + tv.tv_usec / 1000;
-		return time;
+		return (long long)ts.tv_sec * TICKS_PER_SECOND + ts.tv_nsec;
 	}
 
 private:
-	unsigned long _now;
-	unsigned long _prev;
-	unsigned long _elapsed;
-	unsigned long _totalGametime;
+	long long _start;
+	long long _prev;
+	long long _now;
+	long long _elapsed;
+	float _interpolation;
 };
 
 #endif
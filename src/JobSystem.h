@@ -0,0 +1,341 @@
+#ifndef _INCL_JOBSYSTEM
+#define _INCL_JOBSYSTEM
+
+/// Standard libraries
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// JobSystem
+///	 A fixed set of worker threads that run a graph of jobs, each job starting once the jobs it depends
+///  on have finished.  Every thread keeps its own queue of ready jobs: it takes the newest job from its
+///  own queue, so a job that readies another tends to run it next on the same core, and when its queue
+///  is empty it steals the oldest job from another thread.  The calling thread takes part in the work,
+///  and pinned jobs only ever run on it.
+///
+///  The graph is built once and run as many times as needed, such as once per frame.
+class JobSystem
+{
+public:
+	/// Creates a new job system with an empty graph.
+	///  @threads The number of worker threads, in addition to the calling thread.
+	JobSystem(int threads)
+	{
+		capacity = 0;
+		active = 0;
+		generation = 0;
+		stopping = false;
+		unfinished = 0;
+		queued = 0;
+		queuedPinned = 0;
+		sleeping = 0;
+
+		for(int i = 0; i <= threads; i++)
+		{
+			queues.push_back(new Queue());
+		}
+		for(int i = 1; i <= threads; i++)
+		{
+			workers.push_back(std::thread(&JobSystem::work, this, i));
+		}
+	}
+
+	/// Stops and joins the worker threads.
+	~JobSystem(void)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+
+		for(size_t i = 0; i < workers.size(); i++)
+		{
+			workers[i].join();
+		}
+		for(size_t i = 0; i < queues.size(); i++)
+		{
+			delete queues[i];
+		}
+	}
+
+	/// Adds a job to the graph.
+	///  @body The job to run.
+	///  @pinned True to run the job only on the thread calling run, false to run it on any thread.
+	///  @returns The index of the job.
+	int add(const std::function<void(void)>& body, bool pinned)
+	{
+		Job job;
+		job.body = body;
+		job.dependencies = 0;
+		job.pinned = pinned;
+		jobs.push_back(job);
+		return (int)jobs.size() - 1;
+	}
+
+	/// Makes a job wait for another to finish before it starts. The graph must not hold a cycle.
+	///  @job The index of the job that waits.
+	///  @dependency The index of the job waited for.
+	void depend(int job, int dependency)
+	{
+		jobs[dependency].dependents.push_back(job);
+		jobs[job].dependencies++;
+	}
+
+	/// Removes every job from the graph.
+	void clear(void)
+	{
+		jobs.clear();
+	}
+
+	/// Returns the number of jobs in the graph.
+	///  @returns The number of jobs.
+	int getCount(void)
+	{
+		return (int)jobs.size();
+	}
+
+	/// Returns the number of threads that run jobs, including the calling thread.
+	///  @returns The number of threads.
+	int getThreadCount(void)
+	{
+		return (int)queues.size();
+	}
+
+	/// Runs every job of the graph once, each after the jobs it depends on. Returns once every job has run.
+	void run(void)
+	{
+		int count = (int)jobs.size();
+		if(count == 0)
+			return;
+
+		if(count > capacity)
+		{
+			remaining.reset(new std::atomic<int>[count]);
+			capacity = count;
+		}
+		for(int i = 0; i < count; i++)
+		{
+			remaining[i] = jobs[i].dependencies;
+		}
+		unfinished = count;
+
+		// the jobs ready from the start are dealt out, so each thread begins with work of its own
+		int thread = 0;
+		for(int i = 0; i < count; i++)
+		{
+			if(jobs[i].dependencies == 0)
+			{
+				push(thread, i);
+				thread = (thread + 1) % (int)queues.size();
+			}
+		}
+
+		if(!workers.empty())
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				active = (int)workers.size();
+				generation++;
+			}
+			wake.notify_all();
+		}
+
+		execute(0);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return active == 0; });
+	}
+
+private:
+	/// A job of the graph and the jobs waiting for it.
+	struct Job
+	{
+		std::function<void(void)> body;
+		std::vector<int> dependents;
+		int dependencies;
+		bool pinned;
+	};
+
+	/// The ready jobs of a thread. Pinned jobs are kept apart, as no other thread may steal them.
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<int> jobs;
+		std::deque<int> pinned;
+	};
+
+	/// Queues a ready job on a thread, or on the calling thread if the job is pinned, and wakes the
+	///  threads waiting for work.
+	///  @thread The thread that readied the job.
+	///  @job The index of the job.
+	void push(int thread, int job)
+	{
+		Queue* queue = queues[jobs[job].pinned ? 0 : thread];
+		{
+			std::lock_guard<std::mutex> lock(queue->mutex);
+			if(jobs[job].pinned)
+			{
+				queue->pinned.push_back(job);
+				queuedPinned++;
+			}
+			else
+			{
+				queue->jobs.push_back(job);
+				queued++;
+			}
+		}
+
+		// the count is raised before the sleepers are checked, and a thread registers as a sleeper before
+		// checking the count, so either the thread sees the job or the job sees the thread
+		if(sleeping > 0)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+			}
+			ready.notify_all();
+		}
+	}
+
+	/// Blocks until a job may be ready for a thread, or every job of the graph has finished.
+	///  @thread The thread waiting.
+	void idle(int thread)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		sleeping++;
+		ready.wait(lock, [this, thread] { return unfinished == 0 || queued > 0 || (thread == 0 && queuedPinned > 0); });
+		sleeping--;
+	}
+
+	/// Takes a ready job: a pinned job first, then the newest of its own, then the oldest of another thread.
+	///  @thread The thread taking a job.
+	///  @job The index of the job taken.
+	///  @returns True if a job was taken, false if no job is ready.
+	bool take(int thread, int& job)
+	{
+		{
+			Queue* queue = queues[thread];
+			std::lock_guard<std::mutex> lock(queue->mutex);
+			if(!queue->pinned.empty())
+			{
+				job = queue->pinned.front();
+				queue->pinned.pop_front();
+				queuedPinned--;
+				return true;
+			}
+			if(!queue->jobs.empty())
+			{
+				job = queue->jobs.back();
+				queue->jobs.pop_back();
+				queued--;
+				return true;
+			}
+		}
+
+		for(size_t i = 1; i < queues.size(); i++)
+		{
+			Queue* victim = queues[(thread + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim->mutex);
+			if(!victim->jobs.empty())
+			{
+				job = victim->jobs.front();
+				victim->jobs.pop_front();
+				queued--;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/// Runs ready jobs until every job of the graph has finished.
+	///  @thread The thread running the jobs.
+	void execute(int thread)
+	{
+		int job;
+		while(unfinished > 0)
+		{
+			if(!take(thread, job))
+			{
+				// the jobs left are running elsewhere, or wait on those that are
+				idle(thread);
+				continue;
+			}
+
+			jobs[job].body();
+
+			const std::vector<int>& dependents = jobs[job].dependents;
+			for(size_t i = 0; i < dependents.size(); i++)
+			{
+				if(--remaining[dependents[i]] == 0)
+				{
+					push(thread, dependents[i]);
+				}
+			}
+			if(--unfinished == 0)
+			{
+				// the threads still waiting for work are released, as the run is over
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+				}
+				ready.notify_all();
+			}
+		}
+	}
+
+	/// The worker thread loop.
+	///  @thread The index of the thread's queue.
+	void work(int thread)
+	{
+		unsigned int seen = 0;
+		while(true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this, seen] { return stopping || generation != seen; });
+				if(stopping)
+				{
+					return;
+				}
+				seen = generation;
+			}
+
+			execute(thread);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				active--;
+			}
+			done.notify_one();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	std::condition_variable ready;
+	int active;
+	unsigned int generation;
+	bool stopping;
+
+	// Job graph, and the ready queue of each thread, the calling thread first
+	std::vector<Job> jobs;
+	std::vector<Queue*> queues;
+
+	// Progress of the current run
+	std::unique_ptr< std::atomic<int>[] > remaining;
+	int capacity;
+	std::atomic<int> unfinished;
+
+	// Jobs waiting in the queues, pinned ones apart, and the threads waiting for them
+	std::atomic<int> queued;
+	std::atomic<int> queuedPinned;
+	std::atomic<int> sleeping;
+};
+
+#endif
@@ -27,6 +27,9 @@ namespace Logger
 	static const char* LOG_EXIT = "# Game Over - Goodbye";
 	static const char* LOG_ERROR = "# An error occurred while attempting to load asset, terminating.";
 
+	/// Display Messages
+	static const char* LOG_SHMUNAVAILABLE = "# Shared Memory Unavailable, Using XPutImage";
+
 	/// Argument Messages
 	static const char* LOG_ARGINVALID = "# No Arguments Discovered";
 	static const char* LOG_ARGCOUNT = "# Discovered Arguments: ";
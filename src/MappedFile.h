@@ -0,0 +1,111 @@
+#ifndef _INCL_MAPPEDFILE
+#define _INCL_MAPPEDFILE
+
+/// Standard libraries
+#include <stddef.h>
+
+/// System libraries
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/// MappedFile
+///	 A read-only view of a whole file, mapped into memory.  The contents are paged in by the kernel as
+///  they are read, so a file is never copied into a buffer of its own.
+class MappedFile
+{
+public:
+	/// Creates a new mapped file with no file open.
+	MappedFile(void)
+	{
+		data = NULL;
+		size = 0;
+	}
+
+	/// Unmaps the file.
+	~MappedFile(void)
+	{
+		close();
+	}
+
+	/// Maps a file into memory, unmapping the file mapped before.
+	///  @filename The path of the file.
+	///  @returns True if successful, false otherwise.
+	bool open(const char* filename)
+	{
+		return open(filename, false);
+	}
+
+	/// Maps a file into memory, unmapping the file mapped before.
+	///  @filename The path of the file.
+	///  @writable True to allow writes to the mapping. Written pages are copied, so the file never changes.
+	///  @returns True if successful, false otherwise.
+	bool open(const char* filename, bool writable)
+	{
+		close();
+
+		int fd = ::open(filename, O_RDONLY);
+		if(fd < 0)
+		{
+			return false;
+		}
+
+		struct stat info;
+		if(fstat(fd, &info) != 0 || info.st_size <= 0)
+		{
+			::close(fd);
+			return false;
+		}
+
+		// the mapping keeps its own reference to the file, so the descriptor is not needed past here
+		void* view = mmap(NULL, info.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if(view == MAP_FAILED)
+		{
+			return false;
+		}
+
+		// files are read front to back, so the kernel may read ahead aggressively
+		madvise(view, info.st_size, MADV_SEQUENTIAL);
+
+		data = (unsigned char*)view;
+		size = info.st_size;
+		return true;
+	}
+
+	/// Unmaps the file, if one is mapped.
+	void close(void)
+	{
+		if(data != NULL)
+		{
+			munmap(data, size);
+			data = NULL;
+			size = 0;
+		}
+	}
+
+	/// Returns the contents of the file, which may only be written if the file was mapped writable.
+	///  @returns The contents of the file, or NULL if no file is mapped.
+	unsigned char* getData(void)
+	{
+		return data;
+	}
+
+	/// Returns the size of the file.
+	///  @returns The size of the file in bytes.
+	size_t getSize(void)
+	{
+		return size;
+	}
+
+private:
+	/// Mapped files cannot be copied, as both copies would unmap the same view.
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	unsigned char* data;
+	size_t size;
+};
+
+#endif
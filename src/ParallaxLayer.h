@@ -0,0 +1,259 @@
+#ifndef _INCL_PARALLAXLAYER
+#define _INCL_PARALLAXLAYER
+
+/// Standard libraries
+#include <math.h>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+/// X11 libraries
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+/// Project components
+#include "Displayable.h"
+#include "Spritesheet.h"
+#include "XInfo.h"
+
+/// ParallaxLayer
+///	 A background that repeats horizontally and scrolls slower than the world to give a sense of depth.
+///  The layer is rendered once into an image and a server-side pixmap that repeat the background until
+///  they are at least as wide as the screen, so that whatever part of the layer is in view can be drawn
+///  with at most two copies: one up to the wrap-around point and one after it.
+class ParallaxLayer : public Displayable
+{
+public:
+	/// Creates a new layer repeating an image.
+	///  @image The image repeated by the layer, which must outlive the layer.
+	///  @factor The share of the camera movement the layer follows: 0 stays still, 1 moves with the world.
+	ParallaxLayer(XImage* image, float factor)
+	{
+		source = image;
+		sheet = NULL;
+		period = image->width;
+		height = image->height;
+		setup(factor);
+	}
+
+	/// Creates a new layer repeating a grid of tiles.
+	///  @tiles The spritesheet the tiles are drawn from.
+	///  @indices The tile indices, row by row, with -1 for an empty cell.
+	///  @columns The number of tile columns of one repeat of the layer.
+	///  @rows The number of tile rows of the layer.
+	///  @factor The share of the camera movement the layer follows: 0 stays still, 1 moves with the world.
+	ParallaxLayer(Spritesheet* tiles, const int* indices, int columns, int rows, float factor)
+	{
+		source = NULL;
+		sheet = tiles;
+		cells.assign(indices, indices + columns * rows);
+		tileColumns = columns;
+		period = columns * tiles->getSpriteWidth();
+		height = rows * tiles->getSpriteHeight();
+		setup(factor);
+	}
+
+	/// Sets the position of the layer when the camera is at the origin.
+	///  @x The x-coordinate (in screen coordinates) of the layer.
+	///  @y The y-coordinate (in screen coordinates) of the layer.
+	void setPosition(int x, int y)
+	{
+		positionX = x;
+		positionY = y;
+	}
+
+	/// Sets the share of the camera movement the layer follows on each axis.
+	///  @x The horizontal scroll factor.
+	///  @y The vertical scroll factor.
+	void setScrollFactor(float x, float y)
+	{
+		factorX = x;
+		factorY = y;
+	}
+
+	/// Returns the horizontal scroll factor.
+	///  @returns The share of horizontal camera movement the layer follows.
+	float getScrollFactorX(void)
+	{
+		return factorX;
+	}
+
+	/// Returns the vertical scroll factor.
+	///  @returns The share of vertical camera movement the layer follows.
+	float getScrollFactorY(void)
+	{
+		return factorY;
+	}
+
+	/// Draws the part of the layer in view, rendering the layer the first time it is drawn.
+	///  @xinfo The graphics information for game.
+	///  @gameTime Time elapsed since the last call to draw.
+	void draw(XInfo* xinfo, GameTime*)
+	{
+		Camera* camera = xinfo->getCamera();
+		if(image == NULL && !render(xinfo, camera->getWidth()))
+		{
+			return;
+		}
+
+		int y = positionY - (int)floorf(camera->getY() * factorY);
+		if(y >= camera->getHeight() || y + height <= 0)
+			return;
+
+		// the left edge of the screen falls this far into a repeat of the layer
+		int offset = ((int)floorf(camera->getX() * factorX) - positionX) % period;
+		if(offset < 0)
+		{
+			offset += period;
+		}
+
+		// the layer places itself on the screen, so the camera must not move it again
+		bool enabled = camera->isEnabled();
+		camera->setEnabled(false);
+
+		int width = std::min(image->width - offset, camera->getWidth());
+		Pixmap mask = xinfo->getMask(image);
+		xinfo->draw(0, y, offset, 0, width, height, image, surface, mask);
+		if(width < camera->getWidth())
+		{
+			xinfo->draw(width, y, 0, 0, camera->getWidth() - width, height, image, surface, mask);
+		}
+
+		camera->setEnabled(enabled);
+	}
+
+	/// Updates the layer, which holds no state that changes over time.
+	///  @xinfo The graphics information for game.
+	///  @gameTime Time elapsed since the last call to draw.
+	void update(XInfo*, GameTime*)
+	{
+	}
+
+	/// Loads the assets of the layer. The image or spritesheet is loaded by the owner of the layer.
+	///  @xinfo The graphics information for game.
+	void load(XInfo*)
+	{
+	}
+
+	/// Releases the rendered layer.
+	///  @xinfo The graphics information for game.
+	void unload(XInfo* xinfo)
+	{
+		if(image != NULL)
+		{
+			xinfo->freeSurface(surface);
+			xinfo->destroyImage(image);
+			surface = None;
+			image = NULL;
+		}
+	}
+
+	/// Initializes the layer, which needs no services.
+	///  @xinfo The graphics information for game.
+	void initialize(XInfo*)
+	{
+	}
+
+private:
+	/// Sets the state shared by both constructors.
+	///  @factor The scroll factor on both axes.
+	void setup(float factor)
+	{
+		factorX = factor;
+		factorY = factor;
+		positionX = 0;
+		positionY = 0;
+		image = NULL;
+		surface = None;
+	}
+
+	/// Renders enough repeats of the layer to cover the screen, and uploads them.
+	///  @xinfo The graphics information for game.
+	///  @screenWidth The width of the screen.
+	///  @returns True if successful, false if the image cannot be allocated.
+	bool render(XInfo* xinfo, int screenWidth)
+	{
+		int repeats = std::max((screenWidth + period - 1) / period, 1);
+		image = xinfo->createImage(repeats * period, height);
+		if(image == NULL)
+		{
+			return false;
+		}
+		xinfo->clearImage(image);
+
+		if(source != NULL)
+		{
+			for(int row = 0; row < height; row++)
+			{
+				memcpy(image->data + row * image->bytes_per_line, source->data + row * source->bytes_per_line, period * 4);
+			}
+		}
+		else
+		{
+			renderTiles();
+		}
+
+		// the first repeat is copied along the rest of the image
+		for(int row = 0; row < height; row++)
+		{
+			uint32_t* line = (uint32_t*)(image->data + row * image->bytes_per_line);
+			for(int i = 1; i < repeats; i++)
+			{
+				memcpy(line + i * period, line, period * 4);
+			}
+		}
+
+		surface = xinfo->createSurface(image);
+		return true;
+	}
+
+	/// Copies the tiles of the layer into the first repeat of the image.
+	void renderTiles(void)
+	{
+		XImage* tiles = sheet->getImage();
+		const SpriteFrame* frames = sheet->getFrames();
+		unsigned int count = (unsigned int)sheet->getCount();
+		int rows = (int)cells.size() / tileColumns;
+
+		for(int y = 0; y < rows; y++)
+		{
+			for(int x = 0; x < tileColumns; x++)
+			{
+				int tile = cells[y * tileColumns + x];
+				if((unsigned int)tile >= count)
+					continue;
+
+				const SpriteFrame& frame = frames[tile];
+				int left = x * sheet->getSpriteWidth() + frame.offsetX;
+				int top = y * sheet->getSpriteHeight() + frame.offsetY;
+				for(int line = 0; line < frame.height; line++)
+				{
+					memcpy(image->data + (top + line) * image->bytes_per_line + left * 4,
+						tiles->data + (frame.y + line) * tiles->bytes_per_line + frame.x * 4,
+						frame.width * 4);
+				}
+			}
+		}
+	}
+
+	// Source of the layer: an image, or a grid of tiles
+	XImage* source;
+	Spritesheet* sheet;
+	std::vector<int> cells;
+	int tileColumns;
+
+	// Width of one repeat of the layer, and its height
+	int period;
+	int height;
+
+	float factorX;
+	float factorY;
+	int positionX;
+	int positionY;
+
+	// Rendered repeats of the layer
+	XImage* image;
+	Pixmap surface;
+};
+
+#endif
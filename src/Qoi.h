@@ -0,0 +1,310 @@
+#ifndef _INCL_QOI
+#define _INCL_QOI
+
+/// Standard libraries
+#include <stddef.h>
+#include <stdint.h>
+#include <cstring>
+#include <vector>
+
+/// Decodes and encodes QOI ("Quite OK Image") images in memory.  Pixels are 32-bit values laid out as
+///  0xAARRGGBB, the same layout TgaLoader produces, so either format loads into the same XImage.
+///
+///  QOI compresses close to PNG but decodes in a single pass with no entropy coding, which makes it a
+///  fast format for game assets.  The format is described at https://qoiformat.org/qoi-specification.pdf.
+namespace Qoi
+{
+	/// The size of a QOI header, in bytes.
+	static const int HEADER_SIZE = 14;
+
+	/// The largest number of pixels an image may have, so that sizes never overflow.
+	static const long MAX_PIXELS = 400000000L;
+
+	/// Chunk tags.
+	static const int OP_INDEX = 0x00;
+	static const int OP_DIFF = 0x40;
+	static const int OP_LUMA = 0x80;
+	static const int OP_RUN = 0xC0;
+	static const int OP_RGB = 0xFE;
+	static const int OP_RGBA = 0xFF;
+	static const int OP_MASK = 0xC0;
+
+	/// The bytes closing every QOI stream.
+	static const unsigned char PADDING[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+	/// The fields of a QOI header.
+	struct QoiHeader
+	{
+		int width;
+		int height;
+
+		// 3 for RGB, 4 for RGBA; informative only, as every image decodes to RGBA
+		int channels;
+
+		// 0 for sRGB with linear alpha, 1 for all channels linear
+		int colorspace;
+	};
+
+	/// Reads a big-endian 32-bit value.
+	static inline uint32_t readInt(const unsigned char* data)
+	{
+		return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+	}
+
+	/// Appends a big-endian 32-bit value.
+	static inline void writeInt(std::vector<unsigned char>& out, uint32_t value)
+	{
+		out.push_back(value >> 24);
+		out.push_back(value >> 16);
+		out.push_back(value >> 8);
+		out.push_back(value);
+	}
+
+	/// Returns the position of a color in the table of recently seen colors.
+	static inline int hash(uint32_t pixel)
+	{
+		return (((pixel >> 16) & 0xFF) * 3 + ((pixel >> 8) & 0xFF) * 5 + (pixel & 0xFF) * 7 + (pixel >> 24) * 11) % 64;
+	}
+
+	/// Packs four channels into a pixel.
+	static inline uint32_t pack(int r, int g, int b, int a)
+	{
+		return ((uint32_t)(a & 0xFF) << 24) | ((r & 0xFF) << 16) | ((g & 0xFF) << 8) | (b & 0xFF);
+	}
+
+	/// Determines whether a buffer holds a QOI image.
+	///  @data The contents of the file.
+	///  @size The size of the contents in bytes.
+	///  @returns True if the buffer starts with the QOI magic, false otherwise.
+	static inline bool isQoi(const unsigned char* data, size_t size)
+	{
+		return data != NULL && size >= 4 && memcmp(data, "qoif", 4) == 0;
+	}
+
+	/// Reads the header of a QOI image.
+	///  @data The contents of the QOI file.
+	///  @size The size of the contents in bytes.
+	///  @header The header to fill.
+	///  @returns True if the image is a valid QOI image, false otherwise.
+	static inline bool readHeader(const unsigned char* data, size_t size, QoiHeader* header)
+	{
+		if(!isQoi(data, size) || size < (size_t)HEADER_SIZE + sizeof(PADDING))
+		{
+			return false;
+		}
+
+		uint32_t width = readInt(data + 4);
+		uint32_t height = readInt(data + 8);
+		header->channels = data[12];
+		header->colorspace = data[13];
+
+		if(width == 0 || height == 0 || height >= (uint32_t)MAX_PIXELS / width
+			|| (header->channels != 3 && header->channels != 4) || header->colorspace > 1)
+		{
+			return false;
+		}
+
+		header->width = (int)width;
+		header->height = (int)height;
+		return true;
+	}
+
+	/// Decodes the pixels of a QOI image.
+	///  @data The contents of the QOI file.
+	///  @size The size of the contents in bytes.
+	///  @header The header of the image, read by readHeader.
+	///  @pixels The destination pixels, large enough to hold the image.
+	///  @stride The number of pixels between the start of two destination rows.
+	///  @returns True if successful, false if the image data is truncated.
+	static inline bool decode(const unsigned char* data, size_t size, const QoiHeader& header, uint32_t* pixels, int stride)
+	{
+		const unsigned char* src = data + HEADER_SIZE;
+
+		// the padding is never part of a chunk, so chunks can be read without checking each byte
+		const unsigned char* end = data + size - sizeof(PADDING);
+
+		uint32_t index[64];
+		memset(index, 0, sizeof(index));
+
+		uint32_t pixel = 0xFF000000u;
+		int run = 0;
+
+		for(int y = 0; y < header.height; y++)
+		{
+			uint32_t* out = pixels + (size_t)y * stride;
+			for(int x = 0; x < header.width; x++)
+			{
+				if(run > 0)
+				{
+					run--;
+					out[x] = pixel;
+					continue;
+				}
+
+				if(src >= end)
+				{
+					return false;
+				}
+
+				int tag = *src++;
+				if(tag == OP_RGB)
+				{
+					pixel = (pixel & 0xFF000000u) | pack(src[0], src[1], src[2], 0);
+					src += 3;
+				}
+				else if(tag == OP_RGBA)
+				{
+					pixel = pack(src[0], src[1], src[2], src[3]);
+					src += 4;
+				}
+				else
+				{
+					int r = (pixel >> 16) & 0xFF;
+					int g = (pixel >> 8) & 0xFF;
+					int b = pixel & 0xFF;
+
+					switch(tag & OP_MASK)
+					{
+					case OP_INDEX:
+						pixel = index[tag];
+						break;
+					case OP_DIFF:
+						r += ((tag >> 4) & 0x03) - 2;
+						g += ((tag >> 2) & 0x03) - 2;
+						b += (tag & 0x03) - 2;
+						pixel = pack(r, g, b, pixel >> 24);
+						break;
+					case OP_LUMA:
+						{
+							int dg = (tag & 0x3F) - 32;
+							int rb = *src++;
+							r += dg - 8 + ((rb >> 4) & 0x0F);
+							g += dg;
+							b += dg - 8 + (rb & 0x0F);
+							pixel = pack(r, g, b, pixel >> 24);
+						}
+						break;
+					default:
+						run = tag & 0x3F;
+						break;
+					}
+				}
+
+				index[hash(pixel)] = pixel;
+				out[x] = pixel;
+			}
+		}
+
+		return src <= end;
+	}
+
+	/// Encodes pixels as a QOI image.
+	///  @pixels The source pixels.
+	///  @width The width of the image.
+	///  @height The height of the image.
+	///  @stride The number of pixels between the start of two source rows.
+	///  @out The buffer the encoded image is appended to.
+	static inline void encode(const uint32_t* pixels, int width, int height, int stride, std::vector<unsigned char>& out)
+	{
+		// images that are entirely opaque are marked as RGB
+		int channels = 3;
+		for(int y = 0; y < height && channels == 3; y++)
+		{
+			for(int x = 0; x < width; x++)
+			{
+				if((pixels[(size_t)y * stride + x] >> 24) != 0xFF)
+				{
+					channels = 4;
+					break;
+				}
+			}
+		}
+
+		out.reserve(out.size() + HEADER_SIZE + (size_t)width * height + sizeof(PADDING));
+		out.insert(out.end(), "qoif", "qoif" + 4);
+		writeInt(out, width);
+		writeInt(out, height);
+		out.push_back(channels);
+		out.push_back(0);
+
+		uint32_t index[64];
+		memset(index, 0, sizeof(index));
+
+		uint32_t previous = 0xFF000000u;
+		int run = 0;
+		long last = (long)width * height - 1;
+
+		for(long i = 0; i <= last; i++)
+		{
+			uint32_t pixel = pixels[(size_t)(i / width) * stride + i % width];
+
+			if(pixel == previous)
+			{
+				run++;
+				if(run == 62 || i == last)
+				{
+					out.push_back(OP_RUN | (run - 1));
+					run = 0;
+				}
+				continue;
+			}
+
+			if(run > 0)
+			{
+				out.push_back(OP_RUN | (run - 1));
+				run = 0;
+			}
+
+			int position = hash(pixel);
+			if(index[position] == pixel)
+			{
+				out.push_back(OP_INDEX | position);
+			}
+			else
+			{
+				index[position] = pixel;
+
+				int r = (pixel >> 16) & 0xFF, g = (pixel >> 8) & 0xFF, b = pixel & 0xFF;
+				if((pixel >> 24) == (previous >> 24))
+				{
+					int dr = (signed char)(r - ((previous >> 16) & 0xFF));
+					int dg = (signed char)(g - ((previous >> 8) & 0xFF));
+					int db = (signed char)(b - (previous & 0xFF));
+					int dgr = dr - dg;
+					int dgb = db - dg;
+
+					if(dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2)
+					{
+						out.push_back(OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+					}
+					else if(dgr > -9 && dgr < 8 && dg > -33 && dg < 32 && dgb > -9 && dgb < 8)
+					{
+						out.push_back(OP_LUMA | (dg + 32));
+						out.push_back(((dgr + 8) << 4) | (dgb + 8));
+					}
+					else
+					{
+						out.push_back(OP_RGB);
+						out.push_back(r);
+						out.push_back(g);
+						out.push_back(b);
+					}
+				}
+				else
+				{
+					out.push_back(OP_RGBA);
+					out.push_back(r);
+					out.push_back(g);
+					out.push_back(b);
+					out.push_back(pixel >> 24);
+				}
+			}
+
+			previous = pixel;
+		}
+
+		out.insert(out.end(), PADDING, PADDING + sizeof(PADDING));
+	}
+}
+
+#endif
@@ -1,10 +1,36 @@
 #ifndef _INCL_SPRITESHEET
 #define _INCL_SPRITESHEET
 
+/// Standard libraries
+#include <stdio.h>
+#include <vector>
+
 /// X11/XLib libraries
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 
+/// SpriteFrame
+///	 The part of a sprite cell that is drawn: its rectangle in the sheet, and its position within the
+///  cell.  Trimmed frames leave out the transparent border of a sprite.
+struct SpriteFrame
+{
+	int x;
+	int y;
+	int width;
+	int height;
+	int offsetX;
+	int offsetY;
+};
+
+/// SpriteInstance
+///	 A sprite to be drawn from a sheet, for drawing many sprites of one sheet in a single call.
+struct SpriteInstance
+{
+	int x;
+	int y;
+	int index;
+};
+
 /// Spritesheet
 ///  A uniform sheet of sprites that can be drawn individually.
 class Spritesheet
@@ -18,6 +44,10 @@ public:
 	Spritesheet(XImage* image, int xlength, int ylength, int margins)
 	{
 		img = image;
+		clip = None;
+		surface = None;
+		originX = 0;
+		originY = 0;
 		xcount = xlength;
 		ycount = ylength;
 
@@ -28,6 +58,20 @@ public:
 
 		spriteWidth = spritex - 2 * padding;
 		spriteHeight = spritey - 2 * padding;
+
+		trimmed = false;
+		resetFrames();
+	}
+
+	/// Create a new sprite sheet based on a image margins, with a clipping mask covering the image.
+	///  @image The image to be represented by the sprite sheet.
+	///  @xlength The horizontal number of sprite represented by the sheet.
+	///  @ylength The vertical number of sprite represented by the sheet.
+	///  @margins The uniform margin around each sprite.
+	///  @mask The clipping mask of the image.
+	Spritesheet(XImage* image, int xlength, int ylength, int margins, Pixmap mask) : Spritesheet(image, xlength, ylength, margins)
+	{
+		clip = mask;
 	}
 
 	/// Retrieves the image coordinate from the sheet grid coordinate.
@@ -35,32 +79,127 @@ public:
 	///  @y The sheet horizontal position.
 	///  @sourceX The image horizontal position in the sprite sheet.
 	///  @sourceY The image vertical position in the sprite sheet.
-	void getInfo(int x, int y, int* sourceX, int* sourceY)
-	{		
-		if(x < 0 || x >= xcount)
-			return;
-
-		if(y < 0 || y >= ycount)
-			return;
+	///  @returns True if the grid position is on the sheet, false otherwise, in which case the position
+	///   is set to the top-left of the sheet.
+	bool getInfo(int x, int y, int* sourceX, int* sourceY)
+	{
+		if(x < 0 || x >= xcount || y < 0 || y >= ycount)
+		{
+			*sourceX = originX;
+			*sourceY = originY;
+			return false;
+		}
 
-		*sourceX = (x * spritex) + padding;
-		*sourceY = (y * spritey) + padding;
+		*sourceX = originX + (x * spritex) + padding;
+		*sourceY = originY + (y * spritey) + padding;
+		return true;
 	}
 
 	/// Gets the image coordinate position from an index.
 	///  @index The index of an image within the sprite sheet.
 	///  @sourceX The image horizontal position in the sprite sheet.
 	///  @sourceY The image vertical position in the sprite sheet.
-	void getInfo(int index,	int* sourceX, int* sourceY)
+	///  @returns True if the index is on the sheet, false otherwise, in which case the position is set
+	///   to the top-left of the sheet.
+	bool getInfo(int index,	int* sourceX, int* sourceY)
+	{
+		if(index < 0 || index >= (int)cells.size())
+		{
+			*sourceX = originX;
+			*sourceY = originY;
+			return false;
+		}
+
+		*sourceX = cells[index].x;
+		*sourceY = cells[index].y;
+		return true;
+	}
+
+	/// Loads a table of trimmed frames, one line per sprite in index order:
+	///    x y width height offsetX offsetY
+	///  giving the rectangle of the sprite relative to the top-left of the sheet, and the position of the
+	///  rectangle within the sprite cell. Lines starting with # are ignored, and sprites past the end of
+	///  the table keep their whole cell.
+	///  @filename The path of the frame table.
+	///  @returns True if successful, false otherwise, in which case the sheet is left untrimmed.
+	bool loadFrames(const char* filename)
+	{
+		FILE* table = fopen(filename, "r");
+		if(table == NULL)
+		{
+			return false;
+		}
+
+		char line[256];
+		int index = 0;
+		bool valid = true;
+		while(valid && fgets(line, sizeof(line), table) != NULL)
+		{
+			SpriteFrame frame;
+			int fields = sscanf(line, "%d %d %d %d %d %d", &frame.x, &frame.y, &frame.width, &frame.height, &frame.offsetX, &frame.offsetY);
+			if(fields <= 0 || line[0] == '#')
+			{
+				continue;
+			}
+
+			valid = fields == 6 && index < getCount() && setFrame(index++, frame);
+		}
+		fclose(table);
+
+		if(!valid)
+		{
+			trimmed = false;
+			resetFrames();
+		}
+		return valid;
+	}
+
+	/// Sets the trimmed frame of a sprite.
+	///  @index The index of the sprite.
+	///  @frame The frame, relative to the top-left of the sheet. A frame with no width draws nothing.
+	///  @returns True if the frame lies within the sheet and fits in its cell, false otherwise.
+	bool setFrame(int index, const SpriteFrame& frame)
+	{
+		if(index < 0 || index >= getCount() || frame.width < 0 || frame.height < 0
+			|| frame.x < 0 || frame.y < 0 || frame.x + frame.width > getWidth() || frame.y + frame.height > getHeight()
+			|| frame.offsetX < 0 || frame.offsetY < 0
+			|| frame.offsetX + frame.width > spriteWidth || frame.offsetY + frame.height > spriteHeight)
+		{
+			return false;
+		}
+
+		frames[index] = frame;
+		frames[index].x += originX;
+		frames[index].y += originY;
+		trimmed = true;
+		return true;
+	}
+
+	/// Determines whether the sheet has trimmed frames.
+	///  @returns True if a frame table is set, false if every sprite is drawn as its whole cell.
+	bool isTrimmed(void)
+	{
+		return trimmed;
+	}
+
+	/// Gets the frame of a sprite, in image coordinates. Untrimmed sprites cover their whole cell.
+	///  @index The index of the sprite.
+	///  @frame The frame of the sprite.
+	///  @returns True if the sheet has the sprite, false otherwise.
+	bool getFrame(int index, SpriteFrame* frame)
 	{
-		if(index < 0 || index >= (xcount * ycount))
-			return;
+		if(index < 0 || index >= (int)frames.size())
+			return false;
 
-		int posx = index % xcount;
-		int posy = index / xcount;
+		*frame = frames[index];
+		return true;
+	}
 
-		*sourceX = (posx * spritex) + padding;
-		*sourceY = (posy * spritey) + padding;
+	/// Returns the frame table of the sheet, in image coordinates and index order, with getCount entries.
+	///  @returns The frames of every sprite, or NULL if the sheet has none.
+	const SpriteFrame* getFrames(void)
+	{
+		return frames.empty() ? NULL : &frames[0];
 	}
 
 	/// Returns the underlying image of the spritesheet.
@@ -70,6 +209,79 @@ public:
 		return img;
 	}
 
+	/// Moves the sheet onto another image, such as an atlas page the sheet was copied into. The grid is
+	///  kept, and starts at the given position of the new image. The server-side copy of the sheet must
+	///  be released first, as the sheet forgets it.
+	///  @image The image now holding the sheet.
+	///  @x The horizontal position of the sheet in the image.
+	///  @y The vertical position of the sheet in the image.
+	///  @mask The clipping mask of the image, or None.
+	void setSource(XImage* image, int x, int y, Pixmap mask)
+	{
+		for(size_t i = 0; i < frames.size(); i++)
+		{
+			frames[i].x += x - originX;
+			frames[i].y += y - originY;
+			cells[i].x += x - originX;
+			cells[i].y += y - originY;
+		}
+
+		img = image;
+		clip = mask;
+		surface = None;
+		originX = x;
+		originY = y;
+	}
+
+	/// Returns the horizontal position of the sheet within its image.
+	///  @returns The horizontal position of the sheet.
+	int getOriginX(void)
+	{
+		return originX;
+	}
+
+	/// Returns the vertical position of the sheet within its image.
+	///  @returns The vertical position of the sheet.
+	int getOriginY(void)
+	{
+		return originY;
+	}
+
+	/// Returns the width covered by the sheet grid.
+	///  @returns The width of the sheet.
+	int getWidth(void)
+	{
+		return xcount * spritex;
+	}
+
+	/// Returns the height covered by the sheet grid.
+	///  @returns The height of the sheet.
+	int getHeight(void)
+	{
+		return ycount * spritey;
+	}
+
+	/// Returns the clipping mask of the spritesheet.
+	///  @returns The clipping mask, or None if the sheet is unmasked.
+	Pixmap getMask(void)
+	{
+		return clip;
+	}
+
+	/// Returns the server-side copy of the sheet image.
+	///  @returns The sheet pixmap, or None if the sheet has not been uploaded.
+	Pixmap getSurface(void)
+	{
+		return surface;
+	}
+
+	/// Sets the server-side copy of the sheet image.
+	///  @value The sheet pixmap.
+	void setSurface(Pixmap value)
+	{
+		surface = value;
+	}
+
 	/// Get the horizontal sprite number capacity.
 	///  @returns The horizontal sprite number.
 	int getXLength(void)
@@ -106,6 +318,19 @@ public:
 	}
 
 private:
+	/// Fills the tables with the whole cell of every sprite, so lookups need no division.
+	void resetFrames(void)
+	{
+		frames.resize(xcount * ycount);
+		cells.resize(xcount * ycount);
+		for(int i = 0; i < xcount * ycount; i++)
+		{
+			SpriteFrame cell = { originX + (i % xcount) * spritex + padding, originY + (i / xcount) * spritey + padding, spriteWidth, spriteHeight, 0, 0 };
+			frames[i] = cell;
+			cells[i] = cell;
+		}
+	}
+
 	// Column & row count of images
 	int xcount;
 	int ycount;
@@ -120,7 +345,20 @@ private:
 
 	// Padding of his image
 	int padding;
+
+	// Position of the sheet within its image, which is not the origin when the image is an atlas
+	int originX;
+	int originY;
 	XImage* img;
+	Pixmap clip;
+
+	// Server-side copy of the image
+	Pixmap surface;
+
+	// Drawn frame and whole cell of each sprite, in image coordinates
+	std::vector<SpriteFrame> frames;
+	std::vector<SpriteFrame> cells;
+	bool trimmed;
 };
 
 #endif
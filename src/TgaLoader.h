@@ -0,0 +1,385 @@
+#ifndef _INCL_TGALOADER
+#define _INCL_TGALOADER
+
+/// Standard libraries
+#include <stddef.h>
+#include <stdint.h>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+/// Project components
+#include "Blitter.h"
+
+/// Decodes TGA images from memory into 32-bit pixels laid out as 0xAARRGGBB, the layout used by the
+///  software compositor and by 24-bit TrueColor XImages.  Uncompressed and run-length encoded
+///  true-color (15, 16, 24 and 32-bit), grayscale (8-bit) and color-mapped (8 and 16-bit index)
+///  images are supported, in any origin.
+///
+///  The decoder reads from a buffer instead of a file, so it can decode straight from a memory-mapped
+///  file into the final image, without intermediate copies.
+namespace TgaLoader
+{
+	/// Image type codes.
+	enum TGA_TYPE
+	{
+		TGA_COLORMAPPED = 1,
+		TGA_TRUECOLOR = 2,
+		TGA_GRAYSCALE = 3,
+		TGA_RLE_COLORMAPPED = 9,
+		TGA_RLE_TRUECOLOR = 10,
+		TGA_RLE_GRAYSCALE = 11
+	};
+
+	/// The size of the fixed part of a TGA header, in bytes.
+	static const int HEADER_SIZE = 18;
+
+	/// The largest number of pixels an image may have, so that sizes never overflow.
+	static const long MAX_PIXELS = 400000000L;
+
+	/// The fields of a TGA header needed to decode the image.
+	struct TgaHeader
+	{
+		int type;
+		int width;
+		int height;
+
+		// Bytes per stored pixel, or per color map index
+		int pixelBytes;
+
+		// Bits per color map entry, and the number of entries
+		int mapBits;
+		int mapFirst;
+		int mapLength;
+		size_t mapOffset;
+
+		// Offset of the pixel data in the buffer
+		size_t dataOffset;
+
+		bool rle;
+		bool topDown;
+		bool rightToLeft;
+	};
+
+	/// Reads a little-endian 16-bit value.
+	static inline int readShort(const unsigned char* data)
+	{
+		return data[0] | (data[1] << 8);
+	}
+
+	/// Expands a 5-bit color channel to 8 bits.
+	static inline uint32_t expand5(uint32_t value)
+	{
+		return (value << 3) | (value >> 2);
+	}
+
+	/// Converts a 15 or 16-bit ARRRRRGG GGGBBBBB pixel. The attribute bit is ignored, as most writers leave it unset.
+	static inline uint32_t convert16(const unsigned char* src)
+	{
+		uint32_t value = src[0] | (src[1] << 8);
+		return Blitter::ALPHA_MASK | (expand5((value >> 10) & 0x1F) << 16) | (expand5((value >> 5) & 0x1F) << 8) | expand5(value & 0x1F);
+	}
+
+	/// Converts a row of 24-bit BGR pixels to opaque 32-bit pixels.
+	///  @dst The destination row.
+	///  @src The source row.
+	///  @count The number of pixels.
+	static void expandRowScalar(uint32_t* dst, const unsigned char* src, int count)
+	{
+		for(int i = 0; i < count; i++, src += 3)
+		{
+			dst[i] = Blitter::ALPHA_MASK | (src[2] << 16) | (src[1] << 8) | src[0];
+		}
+	}
+
+	/// Converts a row of 8-bit gray pixels to opaque 32-bit pixels.
+	///  @dst The destination row.
+	///  @src The source row.
+	///  @count The number of pixels.
+	static void grayRowScalar(uint32_t* dst, const unsigned char* src, int count)
+	{
+		for(int i = 0; i < count; i++)
+		{
+			dst[i] = Blitter::ALPHA_MASK | (src[i] * 0x010101u);
+		}
+	}
+
+#ifdef BLITTER_X86
+	/// Converts a row of 24-bit BGR pixels to opaque 32-bit pixels, four pixels per shuffle.
+	__attribute__((target("ssse3")))
+	static void expandRowSSSE3(uint32_t* dst, const unsigned char* src, int count)
+	{
+		const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i alpha = _mm_set1_epi32((int)Blitter::ALPHA_MASK);
+
+		// each load reads 16 bytes to use 12, so it must stay two pixels clear of the end of the row
+		int i = 0;
+		for(; i + 6 <= count; i += 4)
+		{
+			__m128i bgr = _mm_loadu_si128((const __m128i*)(src + i * 3));
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_shuffle_epi8(bgr, shuffle), alpha));
+		}
+		expandRowScalar(dst + i, src + i * 3, count - i);
+	}
+
+	/// Converts a row of 8-bit gray pixels to opaque 32-bit pixels, sixteen pixels at a time.
+	static void grayRowSSE2(uint32_t* dst, const unsigned char* src, int count)
+	{
+		const __m128i alpha = _mm_set1_epi32((int)Blitter::ALPHA_MASK);
+
+		int i = 0;
+		for(; i + 16 <= count; i += 16)
+		{
+			__m128i gray = _mm_loadu_si128((const __m128i*)(src + i));
+			__m128i low = _mm_unpacklo_epi8(gray, gray);
+			__m128i high = _mm_unpackhi_epi8(gray, gray);
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_unpacklo_epi16(low, low), alpha));
+			_mm_storeu_si128((__m128i*)(dst + i + 4), _mm_or_si128(_mm_unpackhi_epi16(low, low), alpha));
+			_mm_storeu_si128((__m128i*)(dst + i + 8), _mm_or_si128(_mm_unpacklo_epi16(high, high), alpha));
+			_mm_storeu_si128((__m128i*)(dst + i + 12), _mm_or_si128(_mm_unpackhi_epi16(high, high), alpha));
+		}
+		grayRowScalar(dst + i, src + i, count - i);
+	}
+#endif
+
+	/// Converts a row of 24-bit BGR pixels to opaque 32-bit pixels.
+	///  @dst The destination row.
+	///  @src The source row.
+	///  @count The number of pixels.
+	static void expandRow(uint32_t* dst, const unsigned char* src, int count)
+	{
+#ifdef BLITTER_X86
+		static const bool ssse3 = __builtin_cpu_supports("ssse3");
+		if(ssse3)
+		{
+			expandRowSSSE3(dst, src, count);
+			return;
+		}
+#endif
+		expandRowScalar(dst, src, count);
+	}
+
+	/// Converts a row of 8-bit gray pixels to opaque 32-bit pixels.
+	///  @dst The destination row.
+	///  @src The source row.
+	///  @count The number of pixels.
+	static void grayRow(uint32_t* dst, const unsigned char* src, int count)
+	{
+#ifdef BLITTER_X86
+		grayRowSSE2(dst, src, count);
+#else
+		grayRowScalar(dst, src, count);
+#endif
+	}
+
+	/// Converts a row of stored pixels to 32-bit pixels.
+	///  @header The header of the image.
+	///  @palette The color map of the image, if it has one.
+	///  @dst The destination row.
+	///  @src The stored pixels.
+	///  @count The number of pixels.
+	static void convertRow(const TgaHeader& header, const std::vector<uint32_t>& palette, uint32_t* dst, const unsigned char* src, int count)
+	{
+		if(!palette.empty())
+		{
+			for(int i = 0; i < count; i++, src += header.pixelBytes)
+			{
+				unsigned int index = (header.pixelBytes == 2 ? readShort(src) : src[0]) - header.mapFirst;
+				dst[i] = index < palette.size() ? palette[index] : Blitter::ALPHA_MASK;
+			}
+			return;
+		}
+
+		switch(header.pixelBytes)
+		{
+		case 4:
+			// stored BGRA is already 0xAARRGGBB on little-endian hosts
+			memcpy(dst, src, count * 4);
+			break;
+		case 3:
+			expandRow(dst, src, count);
+			break;
+		case 2:
+			for(int i = 0; i < count; i++, src += 2)
+			{
+				dst[i] = convert16(src);
+			}
+			break;
+		default:
+			grayRow(dst, src, count);
+			break;
+		}
+	}
+
+	/// Reads the header of a TGA image.
+	///  @data The contents of the TGA file.
+	///  @size The size of the contents in bytes.
+	///  @header The header to fill.
+	///  @returns True if the image is a supported TGA image, false otherwise.
+	static bool readHeader(const unsigned char* data, size_t size, TgaHeader* header)
+	{
+		if(data == NULL || size < (size_t)HEADER_SIZE)
+		{
+			return false;
+		}
+
+		int idLength = data[0];
+		int mapType = data[1];
+		int bits = data[16];
+		int descriptor = data[17];
+
+		header->type = data[2];
+		header->mapFirst = readShort(data + 3);
+		header->mapLength = readShort(data + 5);
+		header->mapBits = data[7];
+		header->width = readShort(data + 12);
+		header->height = readShort(data + 14);
+		header->pixelBytes = (bits + 7) / 8;
+		header->rle = header->type >= TGA_RLE_COLORMAPPED;
+		header->rightToLeft = (descriptor & 0x10) != 0;
+		header->topDown = (descriptor & 0x20) != 0;
+
+		switch(header->type)
+		{
+		case TGA_COLORMAPPED:
+		case TGA_RLE_COLORMAPPED:
+			if(mapType != 1 || header->mapLength == 0 || (bits != 8 && bits != 16) || (header->mapBits != 15 && header->mapBits != 16 && header->mapBits != 24 && header->mapBits != 32))
+			{
+				return false;
+			}
+			break;
+		case TGA_TRUECOLOR:
+		case TGA_RLE_TRUECOLOR:
+			if(bits != 15 && bits != 16 && bits != 24 && bits != 32)
+			{
+				return false;
+			}
+			break;
+		case TGA_GRAYSCALE:
+		case TGA_RLE_GRAYSCALE:
+			if(bits != 8)
+			{
+				return false;
+			}
+			break;
+		default:
+			return false;
+		}
+
+		if(header->width <= 0 || header->height <= 0 || header->height >= MAX_PIXELS / header->width)
+		{
+			return false;
+		}
+
+		// the image ID and the color map sit between the header and the pixels, even when unused
+		header->mapOffset = HEADER_SIZE + idLength;
+		header->dataOffset = header->mapOffset;
+		if(mapType == 1)
+		{
+			header->dataOffset += (size_t)header->mapLength * ((header->mapBits + 7) / 8);
+		}
+
+		return header->dataOffset <= size;
+	}
+
+	/// Decodes the pixels of a TGA image.
+	///  @data The contents of the TGA file.
+	///  @size The size of the contents in bytes.
+	///  @header The header of the image, read by readHeader.
+	///  @pixels The destination pixels, large enough to hold the image.
+	///  @stride The number of pixels between the start of two destination rows.
+	///  @returns True if successful, false if the pixel data is truncated.
+	static bool decode(const unsigned char* data, size_t size, const TgaHeader& header, uint32_t* pixels, int stride)
+	{
+		const unsigned char* src = data + header.dataOffset;
+		const unsigned char* end = data + size;
+		int bpp = header.pixelBytes;
+		int width = header.width;
+
+		// the color map is converted once, so indices decode to final pixels
+		std::vector<uint32_t> palette;
+		if(header.type == TGA_COLORMAPPED || header.type == TGA_RLE_COLORMAPPED)
+		{
+			TgaHeader map = header;
+			map.pixelBytes = (header.mapBits + 7) / 8;
+			std::vector<uint32_t> none;
+
+			palette.resize(header.mapLength);
+			convertRow(map, none, &palette[0], data + header.mapOffset, header.mapLength);
+		}
+
+		// run-length packets may continue from one row to the next
+		int packet = 0;
+		bool repeat = false;
+		uint32_t value = 0;
+
+		for(int row = 0; row < header.height; row++)
+		{
+			uint32_t* out = pixels + (size_t)(header.topDown ? row : header.height - 1 - row) * stride;
+
+			if(!header.rle)
+			{
+				if(end - src < (ptrdiff_t)width * bpp)
+				{
+					return false;
+				}
+				convertRow(header, palette, out, src, width);
+				src += width * bpp;
+			}
+			else
+			{
+				int x = 0;
+				while(x < width)
+				{
+					if(packet == 0)
+					{
+						if(src >= end)
+						{
+							return false;
+						}
+						packet = (*src & 0x7F) + 1;
+						repeat = (*src & 0x80) != 0;
+						src++;
+
+						if(repeat)
+						{
+							if(end - src < bpp)
+							{
+								return false;
+							}
+							convertRow(header, palette, &value, src, 1);
+							src += bpp;
+						}
+					}
+
+					int count = std::min(packet, width - x);
+					if(repeat)
+					{
+						Blitter::fillRow(out + x, count, value);
+					}
+					else
+					{
+						if(end - src < (ptrdiff_t)count * bpp)
+						{
+							return false;
+						}
+						convertRow(header, palette, out + x, src, count);
+						src += count * bpp;
+					}
+
+					x += count;
+					packet -= count;
+				}
+			}
+
+			if(header.rightToLeft)
+			{
+				std::reverse(out, out + width);
+			}
+		}
+
+		return true;
+	}
+}
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef _INCL_THREADPOOL
+#define _INCL_THREADPOOL
+
+/// Standard libraries
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// ThreadPool
+///  A fixed set of worker threads that run the iterations of a loop in parallel.  The calling thread
+///  takes part in the work, so a pool with no workers runs loops serially.
+///
+///  Independent tasks can also be queued to run in the background. A loop started while tasks are
+///  queued is run first, by the workers not busy with a task.
+class ThreadPool
+{
+public:
+	/// Creates a new thread pool.
+	///  @threads The number of worker threads, in addition to the calling thread.
+	ThreadPool(int threads)
+	{
+		task = NULL;
+		taskCount = 0;
+		next = 0;
+		active = 0;
+		generation = 0;
+		stopping = false;
+
+		for(int i = 0; i < threads; i++)
+		{
+			workers.push_back(std::thread(&ThreadPool::work, this));
+		}
+	}
+
+	/// Stops and joins the worker threads. Queued tasks that have not started are dropped.
+	~ThreadPool(void)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+
+		for(size_t i = 0; i < workers.size(); i++)
+		{
+			workers[i].join();
+		}
+	}
+
+	/// Runs the body once for every index in [0, count), spreading the indices across the pool. Returns
+	///  once every index has run.
+	///  @count The number of iterations.
+	///  @body The loop body, called with the iteration index.
+	void parallelFor(int count, const std::function<void(int)>& body)
+	{
+		if(workers.empty() || count <= 1)
+		{
+			for(int i = 0; i < count; i++)
+			{
+				body(i);
+			}
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			task = &body;
+			taskCount = count;
+			next = 0;
+			active = (int)workers.size();
+			generation++;
+		}
+		wake.notify_all();
+
+		run(body, count);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return active == 0; });
+		task = NULL;
+	}
+
+	/// Queues a task to run on a worker thread. With no workers, the task runs before submit returns.
+	///  @task The task to run.
+	void submit(const std::function<void(void)>& task)
+	{
+		if(workers.empty())
+		{
+			task();
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.push_back(task);
+		}
+		wake.notify_one();
+	}
+
+	/// Returns the number of threads that take part in a loop, including the calling thread.
+	///  @returns The number of threads.
+	int getThreadCount(void)
+	{
+		return (int)workers.size() + 1;
+	}
+
+	/// Returns the number of worker threads suited to this machine, leaving one core to the caller.
+	///  @returns The number of worker threads.
+	static int getDefaultWorkers(void)
+	{
+		int cores = (int)std::thread::hardware_concurrency();
+		return cores > 1 ? cores - 1 : 0;
+	}
+
+private:
+	/// Claims and runs iterations until none are left.
+	void run(const std::function<void(int)>& body, int count)
+	{
+		int index;
+		while((index = next.fetch_add(1)) < count)
+		{
+			body(index);
+		}
+	}
+
+	/// The worker thread loop.
+	void work(void)
+	{
+		unsigned int seen = 0;
+		while(true)
+		{
+			const std::function<void(int)>* body;
+			int count;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this, seen] { return stopping || generation != seen || !tasks.empty(); });
+				if(stopping)
+				{
+					return;
+				}
+
+				// the caller of a loop is blocked until every worker has joined it, so loops come first
+				if(generation == seen)
+				{
+					std::function<void(void)> queued = tasks.front();
+					tasks.pop_front();
+					lock.unlock();
+
+					queued();
+					continue;
+				}
+
+				seen = generation;
+				body = task;
+				count = taskCount;
+			}
+
+			run(*body, count);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				active--;
+			}
+			done.notify_one();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	// Current loop
+	const std::function<void(int)>* task;
+	int taskCount;
+	std::atomic<int> next;
+	int active;
+	unsigned int generation;
+	bool stopping;
+
+	// Queued background tasks
+	std::deque< std::function<void(void)> > tasks;
+};
+
+#endif
@@ -0,0 +1,379 @@
+#ifndef _INCL_TILELAYER
+#define _INCL_TILELAYER
+
+/// Standard libraries
+#include <stdint.h>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+/// X11 libraries
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+/// Project components
+#include "Displayable.h"
+#include "Spritesheet.h"
+#include "XInfo.h"
+
+/// TileLayer
+///	 A grid of tiles drawn from a spritesheet, such as the terrain of a level.  The grid is divided into
+///  square chunks, and each chunk is rendered once into an image and a server-side pixmap the first
+///  time it is seen.  Each frame only the chunks overlapping the screen are drawn, with one copy per
+///  chunk, so the cost of a frame does not grow with the size of the level.  Chunks that have not been
+///  seen for a while are released once more than the cache limit are held.
+class TileLayer : public Displayable
+{
+public:
+	/// The number of tiles along each side of a chunk.
+	static const int CHUNK_TILES = 16;
+
+	/// The number of rendered chunks held before the least recently drawn are released.
+	static const int DEFAULT_CACHE_LIMIT = 64;
+
+	/// The tile index of an empty cell.
+	static const int EMPTY_TILE = -1;
+
+	/// Creates a new layer with every cell empty.
+	///  @tiles The spritesheet the tiles are drawn from.
+	///  @columns The number of tile columns of the layer.
+	///  @rows The number of tile rows of the layer.
+	TileLayer(Spritesheet* tiles, int columns, int rows)
+	{
+		sheet = tiles;
+		tileColumns = columns;
+		tileRows = rows;
+		tileWidth = tiles->getSpriteWidth();
+		tileHeight = tiles->getSpriteHeight();
+
+		chunkColumns = (columns + CHUNK_TILES - 1) / CHUNK_TILES;
+		chunkRows = (rows + CHUNK_TILES - 1) / CHUNK_TILES;
+		chunks.resize(chunkColumns * chunkRows);
+		for(size_t i = 0; i < chunks.size(); i++)
+		{
+			chunks[i].tiles.assign(CHUNK_TILES * CHUNK_TILES, (int16_t)EMPTY_TILE);
+			chunks[i].filled = 0;
+			chunks[i].image = NULL;
+			chunks[i].surface = None;
+			chunks[i].dirty = false;
+			chunks[i].lastDrawn = 0;
+		}
+
+		positionX = 0;
+		positionY = 0;
+		cacheLimit = DEFAULT_CACHE_LIMIT;
+		frame = 0;
+	}
+
+	/// Sets the tile of a cell. Rendered chunks holding the cell are rendered again when next drawn.
+	///  @column The column of the cell.
+	///  @row The row of the cell.
+	///  @index The index of the tile in the spritesheet, up to 32767, or EMPTY_TILE.
+	void setTile(int column, int row, int index)
+	{
+		if(column < 0 || column >= tileColumns || row < 0 || row >= tileRows || index < EMPTY_TILE || index > INT16_MAX)
+			return;
+
+		Chunk& chunk = chunks[(row / CHUNK_TILES) * chunkColumns + column / CHUNK_TILES];
+		int16_t& tile = chunk.tiles[(row % CHUNK_TILES) * CHUNK_TILES + column % CHUNK_TILES];
+		if(tile == index)
+			return;
+
+		chunk.filled += (index != EMPTY_TILE) - (tile != EMPTY_TILE);
+		tile = (int16_t)index;
+		chunk.dirty = true;
+	}
+
+	/// Returns the tile of a cell.
+	///  @column The column of the cell.
+	///  @row The row of the cell.
+	///  @returns The index of the tile in the spritesheet, or EMPTY_TILE if the cell is empty or outside
+	///   the layer.
+	int getTile(int column, int row)
+	{
+		if(column < 0 || column >= tileColumns || row < 0 || row >= tileRows)
+			return EMPTY_TILE;
+
+		const Chunk& chunk = chunks[(row / CHUNK_TILES) * chunkColumns + column / CHUNK_TILES];
+		return chunk.tiles[(row % CHUNK_TILES) * CHUNK_TILES + column % CHUNK_TILES];
+	}
+
+	/// Sets the position of the top-left of the layer in the world.
+	///  @x The x-coordinate (in world coordinates) of the layer.
+	///  @y The y-coordinate (in world coordinates) of the layer.
+	void setPosition(int x, int y)
+	{
+		positionX = x;
+		positionY = y;
+	}
+
+	/// Returns the horizontal position of the layer in the world.
+	///  @returns The x-coordinate of the layer.
+	int getX(void)
+	{
+		return positionX;
+	}
+
+	/// Returns the vertical position of the layer in the world.
+	///  @returns The y-coordinate of the layer.
+	int getY(void)
+	{
+		return positionY;
+	}
+
+	/// Returns the number of tile columns of the layer.
+	///  @returns The number of columns.
+	int getColumns(void)
+	{
+		return tileColumns;
+	}
+
+	/// Returns the number of tile rows of the layer.
+	///  @returns The number of rows.
+	int getRows(void)
+	{
+		return tileRows;
+	}
+
+	/// Returns the width of the layer.
+	///  @returns The width of the layer in pixels.
+	int getWidth(void)
+	{
+		return tileColumns * tileWidth;
+	}
+
+	/// Returns the height of the layer.
+	///  @returns The height of the layer in pixels.
+	int getHeight(void)
+	{
+		return tileRows * tileHeight;
+	}
+
+	/// Sets the number of rendered chunks held before the least recently drawn are released.
+	///  @value The value to set, at least the number of chunks covering the screen.
+	void setCacheLimit(int value)
+	{
+		cacheLimit = value;
+	}
+
+	/// Returns the number of rendered chunks currently held.
+	///  @returns The number of rendered chunks.
+	int getCachedCount(void)
+	{
+		return (int)cached.size();
+	}
+
+	/// Draws the chunks of the layer overlapping the camera view, rendering those not yet rendered.
+	///  @xinfo The graphics information for game.
+	///  @gameTime Time elapsed since the last call to draw.
+	void draw(XInfo* xinfo, GameTime*)
+	{
+		int chunkWidth = CHUNK_TILES * tileWidth;
+		int chunkHeight = CHUNK_TILES * tileHeight;
+
+		// the camera view, in layer coordinates
+		Camera* camera = xinfo->getCamera();
+		int left = camera->toWorldX(0) - positionX;
+		int top = camera->toWorldY(0) - positionY;
+		int right = left + camera->getWidth();
+		int bottom = top + camera->getHeight();
+		if(right <= 0 || bottom <= 0 || left >= getWidth() || top >= getHeight())
+			return;
+
+		int firstColumn = std::max(left, 0) / chunkWidth;
+		int firstRow = std::max(top, 0) / chunkHeight;
+		int lastColumn = std::min((right - 1) / chunkWidth, chunkColumns - 1);
+		int lastRow = std::min((bottom - 1) / chunkHeight, chunkRows - 1);
+
+		frame++;
+		for(int row = firstRow; row <= lastRow; row++)
+		{
+			for(int column = firstColumn; column <= lastColumn; column++)
+			{
+				int index = row * chunkColumns + column;
+				Chunk& chunk = chunks[index];
+				if(chunk.filled == 0)
+					continue;
+
+				if((chunk.image == NULL || chunk.dirty) && !render(xinfo, index))
+				{
+					continue;
+				}
+				chunk.lastDrawn = frame;
+
+				xinfo->draw(positionX + column * chunkWidth, positionY + row * chunkHeight,
+					0, 0, chunk.image->width, chunk.image->height,
+					chunk.image, chunk.surface, xinfo->getMask(chunk.image));
+			}
+		}
+
+		evict(xinfo);
+	}
+
+	/// Updates the layer, which holds no state that changes over time.
+	///  @xinfo The graphics information for game.
+	///  @gameTime Time elapsed since the last call to draw.
+	void update(XInfo*, GameTime*)
+	{
+	}
+
+	/// Loads the assets of the layer. The spritesheet is loaded by the owner of the layer.
+	///  @xinfo The graphics information for game.
+	void load(XInfo*)
+	{
+	}
+
+	/// Releases every rendered chunk.
+	///  @xinfo The graphics information for game.
+	void unload(XInfo* xinfo)
+	{
+		for(size_t i = 0; i < cached.size(); i++)
+		{
+			release(xinfo, chunks[cached[i]]);
+		}
+		cached.clear();
+	}
+
+	/// Initializes the layer, which needs no services.
+	///  @xinfo The graphics information for game.
+	void initialize(XInfo*)
+	{
+	}
+
+private:
+	/// A square block of cells, and its rendered image when it has been drawn.
+	struct Chunk
+	{
+		std::vector<int16_t> tiles;
+		int filled;
+		XImage* image;
+		Pixmap surface;
+		bool dirty;
+		unsigned long lastDrawn;
+	};
+
+	/// Orders cached chunks from the least to the most recently drawn.
+	struct DrawnBefore
+	{
+		DrawnBefore(const std::vector<Chunk>& list) : chunks(list) {}
+
+		bool operator()(int a, int b) const
+		{
+			return chunks[a].lastDrawn < chunks[b].lastDrawn;
+		}
+
+		const std::vector<Chunk>& chunks;
+	};
+
+	/// Renders the tiles of a chunk into its image, and uploads the image to the server.
+	///  @xinfo The graphics information for game.
+	///  @index The index of the chunk.
+	///  @returns True if successful, false if the image cannot be allocated.
+	bool render(XInfo* xinfo, int index)
+	{
+		Chunk& chunk = chunks[index];
+		int column = index % chunkColumns;
+		int row = index / chunkColumns;
+		int columns = std::min(tileColumns - column * CHUNK_TILES, (int)CHUNK_TILES);
+		int rows = std::min(tileRows - row * CHUNK_TILES, (int)CHUNK_TILES);
+
+		// the mask and surface are built from the pixels, so a changed chunk starts from a new image
+		XImage* image = xinfo->createImage(columns * tileWidth, rows * tileHeight);
+		if(image == NULL)
+		{
+			return false;
+		}
+
+		if(chunk.image != NULL)
+		{
+			release(xinfo, chunk);
+		}
+		else
+		{
+			cached.push_back(index);
+		}
+		xinfo->clearImage(image);
+
+		XImage* source = sheet->getImage();
+		const SpriteFrame* frames = sheet->getFrames();
+		unsigned int count = (unsigned int)sheet->getCount();
+		for(int y = 0; y < rows; y++)
+		{
+			for(int x = 0; x < columns; x++)
+			{
+				int tile = chunk.tiles[y * CHUNK_TILES + x];
+				if((unsigned int)tile >= count)
+					continue;
+
+				const SpriteFrame& frame = frames[tile];
+				int left = x * tileWidth + frame.offsetX;
+				int top = y * tileHeight + frame.offsetY;
+				for(int line = 0; line < frame.height; line++)
+				{
+					memcpy(image->data + (top + line) * image->bytes_per_line + left * 4,
+						source->data + (frame.y + line) * source->bytes_per_line + frame.x * 4,
+						frame.width * 4);
+				}
+			}
+		}
+
+		chunk.image = image;
+		chunk.surface = xinfo->createSurface(image);
+		chunk.dirty = false;
+		return true;
+	}
+
+	/// Releases the rendered image of a chunk, its mask and its server-side copy.
+	///  @xinfo The graphics information for game.
+	///  @chunk The chunk.
+	void release(XInfo* xinfo, Chunk& chunk)
+	{
+		xinfo->freeSurface(chunk.surface);
+		xinfo->destroyImage(chunk.image);
+		chunk.surface = None;
+		chunk.image = NULL;
+	}
+
+	/// Releases the least recently drawn chunks while more than the cache limit are held. Chunks drawn
+	///  this frame are always kept.
+	///  @xinfo The graphics information for game.
+	void evict(XInfo* xinfo)
+	{
+		if((int)cached.size() <= cacheLimit)
+			return;
+
+		std::sort(cached.begin(), cached.end(), DrawnBefore(chunks));
+
+		size_t excess = cached.size() - std::max(cacheLimit, 0);
+		size_t removed = 0;
+		while(removed < excess && chunks[cached[removed]].lastDrawn != frame)
+		{
+			release(xinfo, chunks[cached[removed]]);
+			removed++;
+		}
+		cached.erase(cached.begin(), cached.begin() + removed);
+	}
+
+	Spritesheet* sheet;
+
+	// Size of the layer in tiles, and of a tile in pixels
+	int tileColumns;
+	int tileRows;
+	int tileWidth;
+	int tileHeight;
+
+	// Chunks of the layer, row by row, and the indices of those rendered
+	int chunkColumns;
+	int chunkRows;
+	std::vector<Chunk> chunks;
+	std::vector<int> cached;
+
+	// Position of the layer in the world
+	int positionX;
+	int positionY;
+
+	int cacheLimit;
+	unsigned long frame;
+};
+
+#endif
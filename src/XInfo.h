@@ -3,11 +3,25 @@
 
 /// System libraries
 #include <unistd.h>
+#include <stdint.h>
+#include <climits>
+#include <cstdlib>
+#include <algorithm>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <string>
+#include <map>
+#include <set>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
 
 /// X11 libraries
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/keysymdef.h>
+#include <X11/extensions/XShm.h>
 
 /// Project components
 #include "Spritesheet.h"
@@ -15,6 +29,16 @@
 #include "MouseState.h"
 #include "Rectangle.h"
 #include "Logger.h"
+#include "Compositor.h"
+#include "DrawBatch.h"
+#include "DamageRegion.h"
+#include "MappedFile.h"
+#include "TgaLoader.h"
+#include "Qoi.h"
+#include "AssetBundle.h"
+#include "AssetCache.h"
+#include "Atlas.h"
+#include "Camera.h"
 
 namespace Constants
 {
@@ -31,7 +55,7 @@ namespace Constants
 	static const int DEFAULT_WINDOW_HEIGHT = 600;
 
 	/// The default input masks.
-	static const unsigned int DEFAULT_INPUT_MASK = ButtonPressMask	| KeyPressMask | KeyRelease | PointerMotionMask | EnterWindowMask | LeaveWindowMask | StructureNotifyMask;
+	static const unsigned int DEFAULT_INPUT_MASK = ButtonPressMask	| KeyPressMask | KeyRelease | PointerMotionMask | EnterWindowMask | LeaveWindowMask | StructureNotifyMask | ExposureMask;
 
 	/// The default title of the window.
 	static const char* DEFAULT_TITLE = "XLib Window";
@@ -68,6 +92,63 @@ namespace ColorConstants
 	const unsigned long COLOR_WHITE = 0xFFFFFFL;
 }
 
+/// RenderBackend
+///	 Identifies where the XInfo renders its frames.
+enum RENDER_BACKEND
+{
+	/// Draw calls are sent to the X server as they are made.
+	RENDER_XLIB = 0,
+
+	/// Draw calls are composited into a client-side frame buffer, which is uploaded once per frame.
+	RENDER_SOFTWARE = 1
+};
+
+/// TextItem
+///	 A string drawn at a position in a color.
+struct TextItem
+{
+	std::string text;
+	int x;
+	int y;
+	unsigned long colour;
+};
+
+/// WorldRectangle
+///	 A rectangle in world coordinates, which may lie beyond the range of an XRectangle.
+struct WorldRectangle
+{
+	int x;
+	int y;
+	unsigned int width;
+	unsigned int height;
+};
+
+/// WorldSegment
+///	 A line segment in world coordinates, which may lie beyond the range of an XSegment.
+struct WorldSegment
+{
+	int x1;
+	int y1;
+	int x2;
+	int y2;
+};
+
+/// ColorRectangle
+///	 A rectangle drawn in a color.
+struct ColorRectangle
+{
+	XRectangle rect;
+	unsigned long colour;
+};
+
+/// ColorSegment
+///	 A line segment drawn in a color.
+struct ColorSegment
+{
+	XSegment segment;
+	unsigned long colour;
+};
+
 /// XInfo
 ///	 Performs image rendering, creates resources, handles system-level interactions and contains resources.
 class XInfo
@@ -84,6 +165,10 @@ public:
 	/// XInfo destructor.
 	~XInfo(void)
 	{
+		if(display != NULL)
+		{
+			close();
+		}
 	}
 
 	/// Initializes the standard variables of the wrapper component.
@@ -148,121 +233,495 @@ public:
 
 		// Create Graphics Contexts
 		gdraw = gcontext[0] = XCreateGC(display, window, 0, NULL);
-		XSetForeground(display, gdraw, white);
+		gtext = gcontext[1] = XCreateGC(display, window, 0, NULL);
+		invalidateGraphicState();
+
+		applyForeground(gdraw, white);
 		XSetBackground(display, gdraw, black);
 		XSetFillStyle(display, gdraw, FillSolid);
 
-		gtext = gcontext[1] = XCreateGC(display, window, 0, NULL);
 		XSetBackground(display, gtext, white);
 
 		font = XLoadQueryFont(display, "*x24");
-		XSetFont(display, gtext, font->fid);
+		applyFont(gtext, font->fid);
 
 		int depth = DefaultDepth(display, DefaultScreen(display));
 		pixmap = XCreatePixmap(display, window, hints.width, hints.height, depth);	
 		pix_bounds = new Rectangle(0, 0, hints.width, hints.height);
+		camera.setSize(hints.width, hints.height);
+
+		damage = new DamageRegion(hints.width, hints.height);
+		previous_damage = new DamageRegion(hints.width, hints.height);
+		damage->setFull();
 
 		mouse = new MouseState();
 		keyboard = new KeyboardState();
 
 		XSelectInput(display, window, input_mask);		
+
+		// Shared memory only works when the server runs on this machine, so it is probed at runtime.
+		shm_available = shm_enabled && querySharedMemory();
+
+		if(backend == RENDER_SOFTWARE)
+		{
+			backbuffer = createImage(hints.width, hints.height);
+			if(backbuffer == NULL)
+			{
+				Logger::application_error("Can't create the backbuffer.");
+			}
+
+			if(render_threads < 0)
+			{
+				render_threads = ThreadPool::getDefaultWorkers();
+			}
+			render_pool = new ThreadPool(render_threads);
+			compositor = new Compositor((uint32_t*)backbuffer->data, hints.width, hints.height, backbuffer->bytes_per_line / 4, render_pool);
+			if(color_keyed)
+			{
+				compositor->setColorKey(color_key);
+			}
+			damage_tracking = false;
+		}
+
+		if(damage_tracking)
+		{
+			beginBatch();
+		}
 	}
 
-	/// Loads an image from a file path into the specified image pointer.
+	/// Loads an image from a file path into the specified image pointer. QOI images and TGA images of
+	///  any type are supported, including run-length encoded ones; the format is read from the file.
 	///  @filename Filename, relative to the loader root directory, and including the extension.
 	///  @img A pointer to the loaded image asset.
 	///  @returns True if successful, false otherwise.
-	/// Notes:
-	///		This method was based the following stackoverflow response to a question regarding loading TGA files.
-	///		METHOD URL: http://stackoverflow.com/a/7050007/2127492
 	bool loadImage(const char* filename, XImage** img)
 	{
-		FILE *filePtr;
-		char ucharBad;
-		short int sintBad;
-		long imageSize;
-		int colorMode;
-		char colorSwap;
+		// the file is decoded straight from the mapping into the image, which may be shared with the server
+		MappedFile file;
+		int width, height;
+		if(!file.open(filename) || !readImageSize(file.getData(), file.getSize(), &width, &height))
+		{
+			return false;
+		}
+
+		XImage* image = createImage(width, height);
+		if(image == NULL)
+		{
+			return false;
+		}
+		if(!decodeImage(file.getData(), file.getSize(), (uint32_t*)image->data, image->bytes_per_line / 4))
+		{
+			destroyImage(image);
+			return false;
+		}
+
+		(*img) = image;
+		return true;
+	}
+
+	/// Loads an image through the asset cache, sharing it with every other caller that loads the same
+	///  file. A file is recognized by its path, or by its contents when it is reached through another
+	///  path. Each successful call must be matched by a call to releaseImage.
+	///  @filename Filename, relative to the loader root directory, and including the extension.
+	///  @img A pointer to the shared image.
+	///  @returns True if successful, false otherwise.
+	bool acquireImage(const char* filename, XImage** img)
+	{
+		return acquireImage(filename, img, NULL);
+	}
+
+	/// Loads an image and its clipping mask through the asset cache, as by acquireImage.
+	///  @filename Filename, relative to the loader root directory, and including the extension.
+	///  @img A pointer to the shared image.
+	///  @pxm A pointer to the clipmap of the image, which is freed with the image.
+	///  @returns True if successful, false otherwise.
+	bool acquireImage(const char* filename, XImage** img, Pixmap* pxm)
+	{
+		char* resolved = realpath(filename, NULL);
+		if(resolved == NULL)
+		{
+			return false;
+		}
+		std::string path = resolved;
+		free(resolved);
+
+		XImage* image = cache.acquire(path);
+		if(image == NULL)
+		{
+			// hashing the file is far cheaper than decoding it, so copies under other names are found first
+			MappedFile file;
+			if(!file.open(path.c_str()))
+			{
+				return false;
+			}
+
+			uint64_t contents = AssetCache::hash(file.getData(), file.getSize());
+			image = cache.acquire(path, contents, file.getData(), file.getSize());
+			if(image == NULL)
+			{
+				int width, height;
+				if(!readImageSize(file.getData(), file.getSize(), &width, &height))
+				{
+					return false;
+				}
+
+				image = createImage(width, height);
+				if(image == NULL)
+				{
+					return false;
+				}
+				if(!decodeImage(file.getData(), file.getSize(), (uint32_t*)image->data, image->bytes_per_line / 4))
+				{
+					destroyImage(image);
+					return false;
+				}
+				cache.add(path, contents, file.getSize(), image);
+			}
+		}
+
+		if(pxm != NULL)
+		{
+			(*pxm) = getMask(image);
+			cache.setMask(image, *pxm);
+		}
+
+		(*img) = image;
+		return true;
+	}
+
+	/// Releases a reference to an image loaded through the asset cache. The image and its clipping mask
+	///  are freed with the last reference.
+	///  @img The image.
+	void releaseImage(XImage* img)
+	{
+		if(cache.release(img))
+		{
+			destroyImage(img);
+		}
+	}
+
+	/// Returns the number of images held by the asset cache.
+	///  @returns The number of cached images.
+	int getCacheCount(void)
+	{
+		return cache.getCount();
+	}
+
+	/// Returns the memory used by the images held by the asset cache and their clipping masks.
+	///  @returns The memory used, in bytes.
+	size_t getCacheMemory(void)
+	{
+		return cache.getMemory();
+	}
+
+	/// Requests an image to be loaded in the background. The file is decoded on a worker thread, and the
+	///  image is created on this thread by updateLoading, which Game::game_load calls until every request
+	///  is complete, and the game loop calls once per frame after that without waiting. Images requested
+	///  after loading therefore arrive a few frames later, and must not be drawn until they are set.
+	///  @filename Filename, relative to the loader root directory, and including the extension.
+	///  @img A pointer set to the loaded image, or to NULL if it cannot be loaded. It must remain valid
+	///   until the request completes.
+	void requestImage(const char* filename, XImage** img)
+	{
+		requestImage(filename, img, NULL);
+	}
+
+	/// Requests an image and its clipping mask to be loaded in the background. The mask is built from the
+	///  image alpha or the color key, as by getMask, on the worker thread.
+	///  @filename Filename, relative to the loader root directory, and including the extension.
+	///  @img A pointer set to the loaded image, or to NULL if it cannot be loaded. It must remain valid
+	///   until the request completes.
+	///  @pxm A pointer set to the clipmap of the image, which is owned by the XInfo and freed with the
+	///   image. It must remain valid until the request completes.
+	void requestImage(const char* filename, XImage** img, Pixmap* pxm)
+	{
+		LoadRequest* request = new LoadRequest();
+		request->filename = filename;
+		request->img = img;
+		request->pxm = pxm;
+		request->masked = pxm != NULL && compositor == NULL;
+		request->keyed = color_keyed;
+		request->key = color_key;
+		request->pixels = NULL;
+		request->failed = false;
+
+		(*img) = NULL;
+		if(pxm != NULL)
+		{
+			(*pxm) = None;
+		}
+
+		if(load_pool == NULL)
+		{
+			load_pool = new ThreadPool(ThreadPool::getDefaultWorkers());
+		}
+
+		loads_requested++;
+		load_pool->submit([this, request] { decodeRequest(request); });
+	}
+
+	/// Creates the images of the requests decoded so far, waiting for one to be decoded if none are.
+	///  @timeout The longest time to wait, in microseconds.
+	///  @returns The number of requests still loading.
+	int updateLoading(long timeout)
+	{
+		std::vector<LoadRequest*> completed;
+		{
+			std::unique_lock<std::mutex> lock(load_mutex);
+			if(load_completed.empty() && loads_completed < loads_requested && timeout > 0)
+			{
+				load_done.wait_for(lock, std::chrono::microseconds(timeout));
+			}
+			completed.swap(load_completed);
+		}
+
+		for(size_t i = 0; i < completed.size(); i++)
+		{
+			finishRequest(completed[i]);
+		}
+
+		return loads_requested - loads_completed;
+	}
+
+	/// Returns true if requested images are still loading, false otherwise.
+	///  @returns True if loading, false otherwise.
+	bool isLoading(void)
+	{
+		return loads_completed < loads_requested;
+	}
+
+	/// Returns the share of requested images that are loaded.
+	///  @returns The loaded share, from 0 to 1.
+	double getLoadProgress(void)
+	{
+		return loads_requested > 0 ? (double)loads_completed / loads_requested : 1.0;
+	}
+
+	/// Returns the number of requested images that could not be loaded.
+	///  @returns The number of failed requests.
+	int getLoadFailures(void)
+	{
+		return load_failures;
+	}
+
+	/// Creates an image from decoded 32-bit pixels, placing it in shared memory when the display supports it.
+	///  @pixels The pixel data, allocated with malloc. Ownership is transferred to the image.
+	///  @width The width of the image.
+	///  @height The height of the image.
+	///  @returns The created image.
+	XImage* createImage(char* pixels, int width, int height)
+	{
+		std::unique_lock<std::mutex> lock = lockDisplay();
+		if(shm_available)
+		{
+			XImage* image = createSharedImage(width, height);
+			if(image != NULL)
+			{
+				for(int row = 0; row < height; row++)
+				{
+					memcpy(image->data + (size_t)row * image->bytes_per_line, pixels + (size_t)row * width * 4, (size_t)width * 4);
+				}
+				free(pixels);
+
+				return image;
+			}
+		}
+
+		return XCreateImage(display, CopyFromParent, 24, ZPixmap, 0, pixels, width, height, 32, 0);
+	}
 
-		unsigned char imageTypeCode;
-		short int imageWidth;
-		short int imageHeight;
-		unsigned char bitCount;
-		char* imageData;
+	/// Creates a 32-bit image with uninitialized pixels, placing it in shared memory when the display
+	///  supports it.
+	///  @width The width of the image.
+	///  @height The height of the image.
+	///  @returns The created image, or NULL if its pixels cannot be allocated.
+	XImage* createImage(int width, int height)
+	{
+		std::unique_lock<std::mutex> lock = lockDisplay();
+		if(shm_available)
+		{
+			XImage* image = createSharedImage(width, height);
+			if(image != NULL)
+			{
+				return image;
+			}
+		}
 
-		// Open the TGA file.
-		filePtr = fopen(filename, "rb");
-		if (filePtr == NULL)
+		char* pixels = (char*)malloc((size_t)width * height * 4);
+		if(pixels == NULL)
 		{
 			return NULL;
 		}
+		return XCreateImage(display, CopyFromParent, 24, ZPixmap, 0, pixels, width, height, 32, 0);
+	}
+
+	/// Releases an image and the shared memory segment backing it, if any. While recording, the image is
+	///  released once the snapshots that may draw it have been presented.
+	///  @img The image to destroy.
+	void destroyImage(XImage* img)
+	{
+		if(isRecording())
+		{
+			retire(img, None);
+			return;
+		}
+
+		XShmSegmentInfo* info = (XShmSegmentInfo*)img->obdata;
+		if(info != NULL)
+		{
+			XShmDetach(display, info);
+			XSync(display, False);
+			shmdt(info->shmaddr);
+
+			// the segment is not heap memory; XDestroyImage releases the segment info instead
+			img->data = NULL;
+		}
+
+		// pixels owned elsewhere, such as in a bundle mapping, are left for their owner to release
+		if(borrowed.erase(img) > 0)
+		{
+			img->data = NULL;
+		}
 
-		// Read the two first bytes we don't need.
-		fread(&ucharBad, sizeof(char), 1, filePtr);
-		fread(&ucharBad, sizeof(char), 1, filePtr);
+		std::map<XImage*, Pixmap>::iterator mask = masks.find(img);
+		if(mask != masks.end())
+		{
+			XFreePixmap(display, mask->second);
+			masks.erase(mask);
+		}
 
-		// Which type of image gets stored in imageTypeCode.
-		fread(&imageTypeCode, sizeof(char), 1, filePtr);
+		XDestroyImage(img);
+	}
 
-		// For our purposes, the type code should be 2 (uncompressed RGB image)
-		// or 3 (uncompressed black-and-white images).
-		if (imageTypeCode != 2 && imageTypeCode != 3)
+	/// Loads an image and builds its clipping mask from its alpha, or from the color key if one is set.
+	///  The image is drawn from the client until a server-side copy is made with createSurface, as
+	///  loadSpritesheet does for sheets.
+	///  @filename Filename of the image, relative to the loader root directory, and including the extension.
+	///  @img A pointer to the loaded image asset.
+	///  @pxm A pointer to the clipmap of the image, which is owned by the XInfo and freed with the image.
+	///  @returns True if successful, false otherwise.
+	bool loadImage(const char* filename, XImage** img, Pixmap* pxm)
+	{
+		if(!loadImage(filename, img))
 		{
-			fclose(filePtr);
 			return false;
 		}
 
-		// Read 13 bytes of data we don't need.
-		fread(&sintBad, sizeof(short int), 1, filePtr);
-		fread(&sintBad, sizeof(short int), 1, filePtr);
-		fread(&ucharBad, sizeof(char), 1, filePtr);
-		fread(&sintBad, sizeof(short int), 1, filePtr);
-		fread(&sintBad, sizeof(short int), 1, filePtr);
+		(*pxm) = getMask(*img);
+		return true;
+	}
+
+	/// Loads an image and its clipping mask from an asset bundle. The image pixels are used in place, so
+	///  the bundle must stay open until the image is destroyed.
+	///  @bundle The open bundle.
+	///  @name The name of the image in the bundle.
+	///  @img A pointer to the loaded image asset.
+	///  @pxm A pointer to the clipmap of the image, which is owned by the XInfo and freed with the image, or
+	///   None if the image was packed without a mask.
+	///  @returns True if successful, false otherwise.
+	bool loadImage(AssetBundle* bundle, const char* name, XImage** img, Pixmap* pxm)
+	{
+		const BundleEntry* entry = bundle->find(name, BUNDLE_IMAGE);
+		if(entry == NULL)
+		{
+			return false;
+		}
 
-		// Read the image's width and height.
-		fread(&imageWidth, sizeof(short int), 1, filePtr);
-		fread(&imageHeight, sizeof(short int), 1, filePtr);
+		XImage* image = XCreateImage(display, CopyFromParent, 24, ZPixmap, 0, (char*)bundle->getPixels(entry), entry->width, entry->height, 32, entry->width * 4);
+		if(image == NULL)
+		{
+			return false;
+		}
+		borrowed.insert(image);
 
-		// Read the bit depth.
-		fread(&bitCount, sizeof(char), 1, filePtr);
+		// the mask was packed with the bundle, so it only needs to be sent to the server
+		const unsigned char* bits = bundle->getMask(entry);
+		if(bits != NULL && compositor == NULL)
+		{
+			std::unique_lock<std::mutex> lock = lockDisplay();
+			masks[image] = XCreateBitmapFromData(display, window, (const char*)bits, entry->width, entry->height);
+		}
 
-		// Read one byte of data we don't need.
-		fread(&ucharBad, sizeof(char), 1, filePtr);
+		// images packed without a mask are opaque, and draw unclipped
+		(*img) = image;
+		(*pxm) = bits != NULL ? getMask(image) : None;
+		return true;
+	}
 
-		// Color mode -> 3 = BGR, 4 = BGRA.
-		colorMode = bitCount / 8;
-		imageSize = imageWidth * imageHeight * colorMode;
+	/// Loads a spritesheet and its clipping mask from an asset bundle, with the grid it was packed with.
+	///  With the Xlib backend the sheet is uploaded at once, so it draws with server-side copies.
+	///  @bundle The open bundle.
+	///  @name The name of the image in the bundle.
+	///  @returns The spritesheet, or NULL if the bundle has no such sheet. The sheet is released with
+	///   release, and its image with destroyImage.
+	Spritesheet* loadSpritesheet(AssetBundle* bundle, const char* name)
+	{
+		const BundleEntry* entry = bundle->find(name, BUNDLE_IMAGE);
+		XImage* image;
+		Pixmap mask;
+		if(entry == NULL || entry->columns == 0 || !loadImage(bundle, name, &image, &mask))
+		{
+			return NULL;
+		}
 
-		// Allocate memory for the image data.
-		imageData = (char*)malloc(sizeof(char)*imageSize);
+		Spritesheet* sheet = new Spritesheet(image, entry->columns, entry->rows, entry->margins, mask);
+		upload(sheet);
+		return sheet;
+	}
 
-		// Read the image data.
-		fread(imageData, sizeof(char), imageSize, filePtr);
+	/// Loads a spritesheet from a file and builds its clipping mask, as the loadImage overload building
+	///  masks does. With the Xlib backend the sheet is uploaded at once, so it draws with server-side copies.
+	///  @filename Filename of the image, relative to the loader root directory, and including the extension.
+	///  @columns The horizontal number of sprites in the sheet.
+	///  @rows The vertical number of sprites in the sheet.
+	///  @margins The uniform margin around each sprite.
+	///  @returns The spritesheet, or NULL if the image cannot be loaded. The sheet is released with
+	///   release, and its image with destroyImage.
+	Spritesheet* loadSpritesheet(const char* filename, int columns, int rows, int margins)
+	{
+		XImage* image;
+		Pixmap mask;
+		if(!loadImage(filename, &image, &mask))
+		{
+			return NULL;
+		}
 
-		char *image32 = (char*)malloc(imageWidth * imageHeight * 4);
-		char *p = image32;
+		Spritesheet* sheet = new Spritesheet(image, columns, rows, margins, mask);
+		upload(sheet);
+		return sheet;
+	}
 
-		// Change from BGR to RGB so OpenGL can read the image data.
-		for (int imageIdx = 0; imageIdx < imageSize; imageIdx += colorMode)
+	/// Returns the clipping mask of an image, building it from the image the first time it is needed.
+	///  Pixels with at least half alpha are set, or when a color key is set, pixels that do not match it.
+	///  With the software backend, images are blended with their alpha instead, and None is returned.
+	///  @img The image.
+	///  @returns The clipping mask, which is owned by the XInfo and freed with the image.
+	Pixmap getMask(XImage* img)
+	{
+		if(compositor != NULL)
 		{
-			*(p + 0) = imageData[imageIdx + 0];  // B
-			*(p + 1) = imageData[imageIdx + 1];  // G
-			*(p + 2) = imageData[imageIdx + 2];  // R
-			p = p + 4;
+			return None;
 		}
-		fclose(filePtr);
 
-		(*img) = XCreateImage(display, CopyFromParent, 24, ZPixmap, 0, image32, imageWidth, imageHeight, 32, 0);
+		std::unique_lock<std::mutex> lock = lockDisplay();
+		std::map<XImage*, Pixmap>::iterator cached = masks.find(img);
+		if(cached != masks.end())
+		{
+			return cached->second;
+		}
 
-		return true;
+		Pixmap mask = createMask(img);
+		masks[img] = mask;
+		return mask;
 	}
 
-	/// Loads an image and its associated clipping mask from two file locations.
+	/// Loads an image and its associated clipping mask from two file locations. Prefer building the mask
+	///  from the image, which needs one file less.
 	///  @filename Filename of the image, relative to the loader root directory, and including the extension.
 	///  @img A pointer to the loaded image asset.
 	///  @clipFile Filename of the clipmap, relative to the loader root directory, and including the extension.
 	///  @pxm A pointer to the loaded clipmap asset.
-	///  @returns True if successful, false otherwise.
+	///  @returns True if successful, false if either file cannot be read, in which case no image is kept.
 	bool loadImage(const char* filename, XImage** img, const char* clipFile, Pixmap* pxm)
 	{
 		bool readImage = loadImage(filename, img);
@@ -273,7 +732,29 @@ public:
 
 		unsigned bw = 0, bh = 0;
 		int hsx = 0, hsy = 0;
-		int res = XReadBitmapFile(display, pixmap, clipFile, &bw, &bh, pxm, &hsx, &hsy);
+		int res;
+		{
+			std::unique_lock<std::mutex> lock = lockDisplay();
+			res = XReadBitmapFile(display, pixmap, clipFile, &bw, &bh, pxm, &hsx, &hsy);
+		}
+
+		if(res != BitmapSuccess)
+		{
+			destroyImage(*img);
+			(*img) = NULL;
+			return false;
+		}
+
+		// the compositor cannot read server-side masks, so the mask is folded into the image alpha
+		if(compositor != NULL)
+		{
+			unsigned char* bits;
+			if(XReadBitmapFileData(clipFile, &bw, &bh, &bits, &hsx, &hsy) == BitmapSuccess)
+			{
+				applyMask(*img, bits, bw, bh);
+				XFree(bits);
+			}
+		}
 
 		return true;
 	}
@@ -283,6 +764,7 @@ public:
 	///  @returns The loaded pixmap asset.
 	Pixmap readPixmap(const char* filename)
 	{
+		std::unique_lock<std::mutex> lock = lockDisplay();
 		unsigned bw = 0, bh = 0;
 		int hsx = 0, hsy = 0;
 		Pixmap map;
@@ -292,8 +774,8 @@ public:
 	}
 
 	/// Draws an image with a clipping mask.
-	///  @x The x-coordinate (in screen coordinates) to draw the image.
-	///  @y The y-coordinate (in screen coordinates) to draw the image.
+	///  @x The x-coordinate (in world coordinates) to draw the image.
+	///  @y The y-coordinate (in world coordinates) to draw the image.
 	///  @posx The x-coordinate (in image coordinates) to draw the image.
 	///  @posy The y-coordinate (in image coordinates) to draw the image.
 	///  @width The width of the image to draw.
@@ -302,76 +784,390 @@ public:
 	///  @mask A pointer to the clipmask of the image.
 	void draw(int x, int y,	int posx, int posy,	int width, int height, XImage* img, Pixmap mask)
 	{
-		int srcx = x - posx;
-		int srcy = y - posy;
-
-		XSetClipMask(display, gdraw, mask);
-		XSetClipOrigin(display, gdraw, srcx, srcy);
-
-		XPutImage(display, pixmap, gdraw, img,
-			posx, posy,
-			x, y,
-			width, height);
-
-		XSetClipMask(display, gdraw, None);
+		if(toScreen(x, y, width, height))
+		{
+			drawImage(x, y, posx, posy, width, height, img, mask);
+		}
 	}
 
-	/// Draws an image from a spritesheet.
+	/// Draws an image from a spritesheet. The sheet's own mask is used if it has one, otherwise the
+	///  current clip mask of the sprite graphics context applies. Trimmed sheets only draw the opaque
+	///  part of the sprite, at its place within the cell. Indices outside the sheet draw nothing.
 	///  @sheet The spritesheet to draw the image from.
-	///  @x The x-coordinate (in screen coordinates) to draw the image.
-	///  @y The y-coordinate (in screen coordinates) to draw the image.
+	///  @x The x-coordinate (in world coordinates) to draw the image.
+	///  @y The y-coordinate (in world coordinates) to draw the image.
 	///  @index The index of the image to be drawn.
 	void draw(Spritesheet* sheet, int x, int y, int index)
 	{
-		int srcx, srcy, posx, posy;
-
-		sheet->getInfo(index, &posx, &posy);
-
-		srcx = x - posx;
-		srcy = y - posy;
-
-		XSetClipOrigin(display, gdraw, srcx, srcy);
+		SpriteFrame frame;
+		if(sheet->getFrame(index, &frame))
+		{
+			drawFrame(sheet, frame, x, y);
+		}
+	}
 
-		XPutImage(display, pixmap, gdraw, sheet->getImage(),
-			posx, posy,
-			x, y,
-			sheet->getSpriteWidth(),
-			sheet->getSpriteHeight());
+	/// Draws many images from one spritesheet, as by draw, walking the frame table of the sheet in a
+	///  single pass. Suited to tile layers and particle-like sprites with thousands of cells.
+	///  @sheet The spritesheet to draw the images from.
+	///  @sprites The positions (in world coordinates) and indices of the images.
+	///  @count The number of images.
+	void drawSprites(Spritesheet* sheet, const SpriteInstance* sprites, int count)
+	{
+		const SpriteFrame* frames = sheet->getFrames();
+		unsigned int frameCount = (unsigned int)sheet->getCount();
+		for(int i = 0; i < count; i++)
+		{
+			if((unsigned int)sprites[i].index < frameCount)
+			{
+				drawFrame(sheet, frames[sprites[i].index], sprites[i].x, sprites[i].y);
+			}
+		}
 	}
 
-	/// Adds a string to a batch of sprites for rendering using the specified font, text, position, and color.
-	///  @str A text string.
-	///  @x The x-coordinate (in screen coordinates) to draw the image.
-	///  @y The y-coordinate (in screen coordinates) to draw the image.
-	///  @colour The color to tint a string.
-	void drawString(std::string str, int x, int y, unsigned long colour)
+	/// Trims every sprite of a sheet to the bounding box of its opaque pixels, as decided by the same
+	///  alpha or color key test as clipping masks. Sprites with no opaque pixels draw nothing.
+	///  @sheet The spritesheet to trim.
+	void trimSpritesheet(Spritesheet* sheet)
 	{
-		const char* text = str.c_str();
-		int length = str.length();
-		GC gc_text = getTextDevice();
+		XImage* img = sheet->getImage();
+		int width = sheet->getWidth();
+		int height = sheet->getHeight();
+		int pitch = (width + 7) / 8;
 
-		XSetForeground(display, gc_text, 0UL);
-		for(int rx = -1; rx <= 1; rx++)
+		mask_bits.resize(pitch * height);
+		for(int y = 0; y < height; y++)
 		{
-			for(int ry = -1; ry <= 1; ry++)
+			const uint32_t* row = (const uint32_t*)(img->data + (sheet->getOriginY() + y) * img->bytes_per_line) + sheet->getOriginX();
+			if(color_keyed)
+			{
+				Blitter::keyMaskRow(&mask_bits[y * pitch], row, width, color_key);
+			}
+			else
 			{
-				XDrawString(display, pixmap, gc_text, x - rx, y - ry, text, length);
+				Blitter::alphaMaskRow(&mask_bits[y * pitch], row, width);
 			}
 		}
 
-		XSetForeground(display, gc_text, colour);
-		XDrawString(display, pixmap, gc_text, x, y,	text, length);
+		for(int index = 0; index < sheet->getCount(); index++)
+		{
+			int left, top;
+			sheet->getInfo(index, &left, &top);
+			left -= sheet->getOriginX();
+			top -= sheet->getOriginY();
+
+			int minX = INT_MAX, minY = INT_MAX, maxX = -1, maxY = -1;
+
+			for(int y = top; y < top + sheet->getSpriteHeight(); y++)
+			{
+				for(int x = left; x < left + sheet->getSpriteWidth(); x++)
+				{
+					if(mask_bits[y * pitch + (x >> 3)] >> (x & 7) & 1)
+					{
+						minX = std::min(minX, x);
+						maxX = std::max(maxX, x);
+						minY = std::min(minY, y);
+						maxY = std::max(maxY, y);
+					}
+				}
+			}
+
+			SpriteFrame frame = { left, top, 0, 0, 0, 0 };
+			if(maxX >= 0)
+			{
+				frame.x = minX;
+				frame.y = minY;
+				frame.width = maxX - minX + 1;
+				frame.height = maxY - minY + 1;
+				frame.offsetX = minX - left;
+				frame.offsetY = minY - top;
+			}
+			sheet->setFrame(index, frame);
+		}
 	}
 
-	/// Draws a rectangle outline to the screen.
-	///  @gc The graphic context to be used when drawing the rectangle.
-	///  @x The x-coordinate of the rectangle.
-	///  @y The y-coordinate of the rectangle.
-	///  @width The width of the rectangle.
-	///  @height The height of the rectangle. 
-	void drawRectangle(GC gc, int x, int y, unsigned int width, unsigned int height)
+	/// Uploads the image of a spritesheet into a server-side pixmap, so that drawing from the sheet
+	///  no longer transfers pixels. Sheets from loadSpritesheet are uploaded already; sheets built by the
+	///  caller draw from their image until uploaded, and are clipped by the mask they were built with,
+	///  such as one from getMask.
+	///  @sheet The spritesheet to upload.
+	void upload(Spritesheet* sheet)
 	{
-		XDrawRectangle(display, pixmap, gc, x, y, width, height);
+		if(sheet->getSurface() != None)
+		{
+			return;
+		}
+
+		sheet->setSurface(createSurface(sheet->getImage()));
+	}
+
+	/// Releases the server-side pixmap of a spritesheet.
+	///  @sheet The spritesheet to release.
+	void release(Spritesheet* sheet)
+	{
+		if(sheet->getSurface() == None)
+		{
+			return;
+		}
+
+		freeSurface(sheet->getSurface());
+		sheet->setSurface(None);
+	}
+
+	/// Packs the images added to an atlas into pages and copies their pixels, building a clipping mask
+	///  for each page. Spritesheets added to the atlas draw from their page until the atlas is destroyed.
+	///  Pixmaps uploaded for those spritesheets are released.
+	///  @atlas The atlas to build.
+	///  @returns True if every image fits on a page and every page could be allocated, false otherwise.
+	bool buildAtlas(Atlas* atlas)
+	{
+		if(atlas->isBuilt() || !atlas->pack())
+		{
+			return false;
+		}
+
+		std::vector<XImage*> pages;
+		std::vector<Pixmap> masks;
+		for(int page = 0; page < atlas->getPageCount(); page++)
+		{
+			XImage* image = createImage(atlas->getPageWidth(), atlas->getPageHeight(page));
+			if(image == NULL)
+			{
+				// the masks are freed with their pages
+				for(size_t i = 0; i < pages.size(); i++)
+				{
+					destroyImage(pages[i]);
+				}
+				return false;
+			}
+
+			atlas->render(page, image);
+			pages.push_back(image);
+			masks.push_back(getMask(image));
+		}
+
+		// the sheets are moved onto the pages, so their own server-side copies would be lost
+		for(int i = 0; i < atlas->getCount(); i++)
+		{
+			Spritesheet* sheet = atlas->getSheet(i);
+			if(sheet != NULL)
+			{
+				release(sheet);
+			}
+		}
+
+		atlas->setPages(pages, masks);
+		return true;
+	}
+
+	/// Releases the pages of an atlas, their clipping masks and their server-side copies. Spritesheets in
+	///  the atlas draw from their own images again, without server-side copies until uploaded.
+	///  @atlas The atlas to destroy the pages of.
+	void destroyAtlas(Atlas* atlas)
+	{
+		if(!atlas->isBuilt())
+		{
+			return;
+		}
+
+		release(atlas);
+		for(int page = 0; page < atlas->getPageCount(); page++)
+		{
+			destroyImage(atlas->getPage(page));
+		}
+		atlas->clearPages();
+	}
+
+	/// Uploads the pages of an atlas into server-side pixmaps, which the spritesheets in the atlas then
+	///  draw from as well. Atlas spritesheets must be released through the atlas, not one by one.
+	///  @atlas The atlas to upload.
+	void upload(Atlas* atlas)
+	{
+		for(int page = 0; atlas->isBuilt() && page < atlas->getPageCount(); page++)
+		{
+			if(atlas->getSurface(page) != None)
+			{
+				continue;
+			}
+
+			atlas->setSurface(page, createSurface(atlas->getPage(page)));
+		}
+	}
+
+	/// Releases the server-side pixmaps of the pages of an atlas.
+	///  @atlas The atlas to release.
+	void release(Atlas* atlas)
+	{
+		for(int page = 0; atlas->isBuilt() && page < atlas->getPageCount(); page++)
+		{
+			if(atlas->getSurface(page) != None)
+			{
+				freeSurface(atlas->getSurface(page));
+				atlas->setSurface(page, None);
+			}
+		}
+	}
+
+	/// Draws a sprite from an atlas, clipped by the mask of its page.
+	///  @atlas The atlas. Nothing is drawn until it is built.
+	///  @handle The handle of the sprite.
+	///  @x The x-coordinate (in world coordinates) to draw the sprite.
+	///  @y The y-coordinate (in world coordinates) to draw the sprite.
+	void draw(Atlas* atlas, int handle, int x, int y)
+	{
+		if(!atlas->isBuilt() || handle < 0 || handle >= atlas->getCount())
+		{
+			return;
+		}
+
+		const AtlasSprite& sprite = atlas->get(handle);
+		draw(x, y, sprite.x, sprite.y, sprite.width, sprite.height,
+			atlas->getPage(sprite.page), atlas->getSurface(sprite.page), atlas->getPageMask(sprite.page));
+	}
+
+	/// Draws an image with a clipping mask from its server-side copy, or from the image itself when it
+	///  has no copy or the software backend is used.
+	///  @x The x-coordinate (in world coordinates) to draw the image.
+	///  @y The y-coordinate (in world coordinates) to draw the image.
+	///  @posx The x-coordinate (in image coordinates) to draw the image.
+	///  @posy The y-coordinate (in image coordinates) to draw the image.
+	///  @width The width of the image to draw.
+	///  @height The height of the image to draw.
+	///  @img A pointer to the image asset to be drawn.
+	///  @surface The server-side copy of the image, or None.
+	///  @mask A pointer to the clipmask of the image.
+	void draw(int x, int y, int posx, int posy, int width, int height, XImage* img, Pixmap surface, Pixmap mask)
+	{
+		if(toScreen(x, y, width, height))
+		{
+			drawSurface(x, y, posx, posy, width, height, img, surface, mask);
+		}
+	}
+
+	/// Uploads a whole image into a new server-side pixmap, so that drawing it no longer transfers pixels.
+	///  @img The image to upload.
+	///  @returns The pixmap, or None with the software backend, which composites from the image itself.
+	Pixmap createSurface(XImage* img)
+	{
+		if(compositor != NULL)
+		{
+			return None;
+		}
+
+		std::unique_lock<std::mutex> lock = lockDisplay();
+		Pixmap surface = XCreatePixmap(display, window, img->width, img->height, DefaultDepth(display, screen));
+
+		// the whole image is uploaded, so no clip mask may be left on the context
+		applyClipMask(gdraw, None);
+		putImage(surface, img, 0, 0, 0, 0, img->width, img->height);
+		return surface;
+	}
+
+	/// Releases a server-side pixmap created by createSurface. While recording, the pixmap is released once
+	///  the snapshots that may draw it have been presented.
+	///  @surface The pixmap, or None.
+	void freeSurface(Pixmap surface)
+	{
+		if(surface != None && isRecording())
+		{
+			retire(NULL, surface);
+		}
+		else if(surface != None)
+		{
+			XFreePixmap(display, surface);
+		}
+	}
+
+	/// Fills an image with transparent pixels: the color key when one is set, otherwise zero alpha.
+	///  @img The image to clear.
+	void clearImage(XImage* img)
+	{
+		uint32_t value = color_keyed ? (uint32_t)color_key : 0;
+		for(int y = 0; y < img->height; y++)
+		{
+			uint32_t* row = (uint32_t*)(img->data + y * img->bytes_per_line);
+			std::fill(row, row + img->width, value);
+		}
+	}
+
+	/// Adds a string to a batch of sprites for rendering using the specified font, text, position, and color.
+	///  @str A text string.
+	///  @x The x-coordinate (in world coordinates) to draw the image.
+	///  @y The y-coordinate (in world coordinates) to draw the image.
+	///  @colour The color to tint a string.
+	///  With the software backend, strings are drawn over the composited frame when it is presented.
+	void drawString(std::string str, int x, int y, unsigned long colour)
+	{
+		x = camera.toScreenX(x);
+		y = camera.toScreenY(y);
+
+		if(compositor != NULL && !isRecording())
+		{
+			TextItem item = { str, x, y, colour };
+			texts.push_back(item);
+			return;
+		}
+
+		if(isRecording() || batching)
+		{
+			recordString(str.c_str(), str.length(), x, y, colour);
+			return;
+		}
+
+		renderString(str, x, y, colour);
+	}
+
+	/// Draws a list of strings to the screen. Strings of the same color share their requests.
+	///  @items The strings to draw.
+	///  @count The number of strings.
+	void drawStrings(const TextItem* items, int count)
+	{
+		if(compositor != NULL && !isRecording())
+		{
+			for(int i = 0; i < count; i++)
+			{
+				TextItem item = { items[i].text, camera.toScreenX(items[i].x), camera.toScreenY(items[i].y), items[i].colour };
+				texts.push_back(item);
+			}
+			return;
+		}
+
+		bool open = openBatch();
+		for(int i = 0; i < count; i++)
+		{
+			recordString(items[i].text.c_str(), items[i].text.length(), camera.toScreenX(items[i].x), camera.toScreenY(items[i].y), items[i].colour);
+		}
+		if(open)
+		{
+			endBatch();
+		}
+	}
+
+	/// Draws a rectangle outline to the screen.
+	///  @gc The graphic context to be used when drawing the rectangle.
+	///  @x The x-coordinate of the rectangle.
+	///  @y The y-coordinate of the rectangle.
+	///  @width The width of the rectangle.
+	///  @height The height of the rectangle. 
+	void drawRectangle(GC gc, int x, int y, unsigned int width, unsigned int height)
+	{
+		XRectangle rect;
+		if(!toScreen(x, y, width, height, true, rect))
+		{
+			return;
+		}
+
+		if(compositor != NULL || isRecording() || batching)
+		{
+			outlineRectangle(gc, rect, getForeground(gc));
+			return;
+		}
+
+		if(gc == gdraw)
+		{
+			syncGraphicState();
+		}
+
+		XDrawRectangle(display, pixmap, gc, rect.x, rect.y, rect.width, rect.height);
 	}
 
 	/// Draws a rectangle to the screen.
@@ -382,7 +1178,153 @@ public:
 	///  @height The height of the rectangle. 
 	void fillRectangle(GC gc, int x, int y, unsigned int width, unsigned int height)
 	{
-		XFillRectangle(display, pixmap, gc, x, y, width, height);
+		XRectangle rect;
+		if(!toScreen(x, y, width, height, false, rect))
+		{
+			return;
+		}
+
+		if(compositor != NULL || isRecording() || batching)
+		{
+			fillRectangle(gc, rect, getForeground(gc));
+			return;
+		}
+
+		if(gc == gdraw)
+		{
+			syncGraphicState();
+		}
+
+		XFillRectangle(display, pixmap, gc, rect.x, rect.y, rect.width, rect.height);
+	}
+
+	/// Draws a list of rectangle outlines to the screen in the color of the graphic context.
+	///  @gc The graphic context to be used when drawing.
+	///  @rects The rectangles to draw.
+	///  @count The number of rectangles.
+	void drawRectangles(GC gc, const XRectangle* world, int count)
+	{
+		XRectangle* rects = toScreen(world, count, true);
+		submitOutlines(gc, rects, count);
+	}
+
+	/// Draws a list of rectangle outlines to the screen in the color of the graphic context. The
+	///  rectangles may lie anywhere in the world, beyond the range of an XRectangle.
+	///  @gc The graphic context to be used when drawing.
+	///  @rects The rectangles to draw.
+	///  @count The number of rectangles.
+	void drawRectangles(GC gc, const WorldRectangle* world, int count)
+	{
+		XRectangle* rects = toScreen(world, count, true);
+		submitOutlines(gc, rects, count);
+	}
+
+	/// Draws a list of rectangle outlines to the screen, each in its own color. Rectangles of the same
+	///  color share their requests, and the color of the graphic context is left unchanged.
+	///  @gc The graphic context to be used when drawing.
+	///  @rects The rectangles to draw.
+	///  @count The number of rectangles.
+	void drawRectangles(GC gc, const ColorRectangle* rects, int count)
+	{
+		bool open = openBatch();
+		for(int i = 0; i < count; i++)
+		{
+			XRectangle rect = rects[i].rect;
+			if(toScreen(rect, true))
+			{
+				outlineRectangle(gc, rect, rects[i].colour);
+			}
+		}
+		if(open)
+		{
+			endBatch();
+		}
+	}
+
+	/// Draws a list of rectangles to the screen in the color of the graphic context.
+	///  @gc The graphic context to be used when drawing.
+	///  @rects The rectangles to draw.
+	///  @count The number of rectangles.
+	void fillRectangles(GC gc, const XRectangle* world, int count)
+	{
+		XRectangle* rects = toScreen(world, count, false);
+		submitFills(gc, rects, count);
+	}
+
+	/// Draws a list of rectangles to the screen in the color of the graphic context. The rectangles may
+	///  lie anywhere in the world, beyond the range of an XRectangle.
+	///  @gc The graphic context to be used when drawing.
+	///  @rects The rectangles to draw.
+	///  @count The number of rectangles.
+	void fillRectangles(GC gc, const WorldRectangle* world, int count)
+	{
+		XRectangle* rects = toScreen(world, count, false);
+		submitFills(gc, rects, count);
+	}
+
+	/// Draws a list of rectangles to the screen, each in its own color. Rectangles of the same color
+	///  share their requests, and the color of the graphic context is left unchanged.
+	///  @gc The graphic context to be used when drawing.
+	///  @rects The rectangles to draw.
+	///  @count The number of rectangles.
+	void fillRectangles(GC gc, const ColorRectangle* rects, int count)
+	{
+		bool open = openBatch();
+		for(int i = 0; i < count; i++)
+		{
+			XRectangle rect = rects[i].rect;
+			if(toScreen(rect, false))
+			{
+				fillRectangle(gc, rect, rects[i].colour);
+			}
+		}
+		if(open)
+		{
+			endBatch();
+		}
+	}
+
+	/// Draws a list of line segments to the screen in the color of the graphic context.
+	///  @gc The graphic context to be used when drawing.
+	///  @segments The segments to draw.
+	///  @count The number of segments.
+	void drawSegments(GC gc, const XSegment* world, int count)
+	{
+		XSegment* segments = toScreen(world, count);
+		submitSegments(gc, segments, count);
+	}
+
+	/// Draws a list of line segments to the screen in the color of the graphic context. The segments may
+	///  lie anywhere in the world, beyond the range of an XSegment.
+	///  @gc The graphic context to be used when drawing.
+	///  @segments The segments to draw.
+	///  @count The number of segments.
+	void drawSegments(GC gc, const WorldSegment* world, int count)
+	{
+		XSegment* segments = toScreen(world, count);
+		submitSegments(gc, segments, count);
+	}
+
+	/// Draws a list of line segments to the screen, each in its own color. Segments of the same color
+	///  share their requests, and the color of the graphic context is left unchanged.
+	///  @gc The graphic context to be used when drawing.
+	///  @segments The segments to draw.
+	///  @count The number of segments.
+	void drawSegments(GC gc, const ColorSegment* segments, int count)
+	{
+		bool open = openBatch();
+		for(int i = 0; i < count; i++)
+		{
+			XSegment segment = segments[i].segment;
+			if(toScreen(segment))
+			{
+				drawSegment(gc, segment, segments[i].colour);
+			}
+		}
+		if(open)
+		{
+			endBatch();
+		}
 	}
 
 	/// Sets the draw color of the graphic context.
@@ -390,179 +1332,2125 @@ public:
 	///  @value The color value to specify.
 	void setColor(GC gc, const unsigned long value)
 	{
-		XSetForeground(display, gc, value); 
+		colours[gc] = value;
+		if(!isRecording())
+		{
+			applyForeground(gc, value);
+		}
 	}
 
-	/// Sets the clip mask of the sprite graphics context.
+	/// Sets the clip mask of the sprite graphics context. The mask is sent to the server by the next
+	///  call that draws with it.
 	///  @img_mask Specifies the pixmap of the graphics device.
 	void setMask(Pixmap img_mask)
 	{
-		XSetClipMask(display, gdraw, img_mask);
+		// the compositor takes transparency from the image alpha instead
+		if(compositor != NULL)
+		{
+			return;
+		}
+
+		setClipState(img_mask, clip_x, clip_y);
 	}
 
 	/// Clears the clip mask of the sprite graphics context.
 	void clearMask(void)
 	{
-		XSetClipMask(display, gdraw, None);
+		if(compositor != NULL)
+		{
+			return;
+		}
+
+		setClipState(None, clip_x, clip_y);
 	}
 
-	/// Clears image resource buffers.
+	/// Clears image resource buffers. With damage tracking, only the damaged parts of the buffer are
+	///  cleared, once the draw calls of the frame are known. While recording, the clear is recorded with
+	///  the current color of the sprite graphics context.
 	void clear(void)
 	{
+		if(isRecording())
+		{
+			BatchCommand command = createCommand(BATCH_CLEAR, gdraw, 0, 0, getImageWidth(), getImageHeight());
+			command.colour = getForeground(gdraw);
+			getBatch().add(command);
+			return;
+		}
+
+		if(compositor != NULL)
+		{
+			compositor->clear(getForeground(gdraw));
+			return;
+		}
+
+		if(damage_tracking)
+		{
+			clear_pending = true;
+			return;
+		}
+
+		if(batching)
+		{
+			recordRectangle(BATCH_FILL, gdraw, 0, 0, getImageWidth(), getImageHeight(), getForeground(gdraw));
+			return;
+		}
+
+		syncGraphicState();
 		XFillRectangle(display, pixmap, gdraw, 0, 0, getImageWidth(), getImageHeight());
 	}
 
-	/// Presents the display with the contents of the buffer in the sequence of back buffers owned by the XInfo.
-	void flush(void)
+	/// Presents the display with the contents of the buffer in the sequence of back buffers owned by the XInfo.
+	///  While recording, frames are presented through presentSnapshot instead.
+	void flush(void)
+	{
+		if(isRecording())
+		{
+			return;
+		}
+
+		endBatch();
+
+		if(compositor != NULL)
+		{
+			present();
+		}
+
+		// the frame is never clipped on its way to the window
+		applyClipMask(gdraw, None);
+		if(damage_tracking)
+		{
+			presentDamage();
+		}
+		else
+		{
+			XCopyArea(display, pixmap, window, gdraw,	0, 0, getImageWidth(), getImageHeight(), pix_bounds->getLeft(), pix_bounds->getTop());
+		}
+
+		XFlush(display);
+
+		frame_changes = requests_issued;
+		frame_avoided = requests_avoided;
+		requests_issued = 0;
+		requests_avoided = 0;
+
+		// damage is only known for deferred draw calls, so every frame is batched
+		if(damage_tracking)
+		{
+			beginBatch();
+		}
+	}
+
+	/// Returns true if only the damaged parts of each frame are cleared and presented, false otherwise.
+	///  @returns True if damage tracking is enabled, false otherwise.
+	bool isDamageTracking(void)
+	{
+		return damage_tracking;
+	}
+
+	/// Sets whether only the damaged parts of each frame are cleared and presented. The damage of a
+	///  frame is the area touched by its draw calls; clear erases the damage of this frame and the last,
+	///  and flush copies the same area to the window. Content that is not drawn every frame survives
+	///  only outside of the damage, unless it is part of a captured background. Has no effect with the
+	///  software backend.
+	///  @value The value to set.
+	void setDamageTracking(bool value)
+	{
+		damage_tracking = value && compositor == NULL;
+		invalidate();
+
+		if(damage_tracking && display != NULL)
+		{
+			beginBatch();
+		}
+	}
+
+	/// Marks the whole frame as damaged, so the next frame is cleared and presented in full.
+	void invalidate(void)
+	{
+		if(damage != NULL)
+		{
+			damage->setFull();
+		}
+	}
+
+	/// Captures the frame being drawn as the background, once it is presented. With damage tracking,
+	///  clear restores damaged areas from the background instead of filling them.
+	void captureBackground(void)
+	{
+		capture_pending = true;
+	}
+
+	/// Releases the captured background.
+	void releaseBackground(void)
+	{
+		if(background != None)
+		{
+			XFreePixmap(display, background);
+			background = None;
+		}
+		capture_pending = false;
+	}
+
+	/// Begins a batch. Draw calls made until the batch ends are queued, then submitted grouped by
+	///  graphics context state, so that fewer state changes and requests are sent to the server.
+	///  Draw calls that overlap keep their relative order. Has no effect with the software backend,
+	///  which always defers drawing.
+	void beginBatch(void)
+	{
+		if(compositor != NULL || batching)
+		{
+			return;
+		}
+
+		batching = true;
+	}
+
+	/// Ends the current batch and submits its draw calls. Called by flush if a batch is still open.
+	void endBatch(void)
+	{
+		if(!batching)
+		{
+			return;
+		}
+		batching = false;
+		batch.sort();
+
+		if(damage_tracking)
+		{
+			recordDamage();
+		}
+
+		// the foreground colors set by the caller, restored once the batch is submitted
+		unsigned long drawColour = gstate[0].foreground;
+		unsigned long textColour = gstate[1].foreground;
+		std::vector<GC> contexts;
+
+		int count = batch.getCount();
+		int index = 0;
+		while(index < count)
+		{
+			BatchCommand& command = batch.get(index);
+			int end = index + 1;
+
+			if(command.gc == gdraw)
+			{
+				applyClip(command.mask, command.originX, command.originY);
+			}
+			if(command.gc != gdraw && command.gc != gtext && std::find(contexts.begin(), contexts.end(), command.gc) == contexts.end())
+			{
+				contexts.push_back(command.gc);
+				batch_colours.push_back(getForeground(command.gc));
+			}
+
+			switch(command.type)
+			{
+			case BATCH_SURFACE:
+				XCopyArea(display, command.surface, pixmap, gdraw,
+					command.posx, command.posy,
+					command.width, command.height,
+					command.x, command.y);
+				break;
+			case BATCH_IMAGE:
+				putImage(command.image,
+					command.posx, command.posy,
+					command.x, command.y,
+					command.width, command.height);
+				break;
+			case BATCH_FILL:
+			case BATCH_OUTLINE:
+				{
+					applyForeground(command.gc, command.colour);
+
+					// consecutive rectangles of the same state are submitted as one request
+					batch_rects.clear();
+					for(end = index; end < count && mergeable(batch.get(end), command); end++)
+					{
+						BatchCommand& rect = batch.get(end);
+						XRectangle value = { (short)rect.x, (short)rect.y, (unsigned short)rect.width, (unsigned short)rect.height };
+						batch_rects.push_back(value);
+					}
+
+					if(command.type == BATCH_FILL)
+					{
+						XFillRectangles(display, pixmap, command.gc, &batch_rects[0], batch_rects.size());
+					}
+					else
+					{
+						XDrawRectangles(display, pixmap, command.gc, &batch_rects[0], batch_rects.size());
+					}
+				}
+				break;
+			case BATCH_SEGMENT:
+				{
+					applyForeground(command.gc, command.colour);
+
+					batch_segments.clear();
+					for(end = index; end < count && mergeable(batch.get(end), command); end++)
+					{
+						BatchCommand& line = batch.get(end);
+						XSegment value = { (short)line.x, (short)line.y, (short)line.posx, (short)line.posy };
+						batch_segments.push_back(value);
+					}
+
+					XDrawSegments(display, pixmap, command.gc, &batch_segments[0], batch_segments.size());
+				}
+				break;
+			case BATCH_STRING:
+				{
+					// strings of the same color and layer share one outline pass and one fill pass; overlapping
+					// strings sit in different layers, so no outline is drawn over an earlier fill
+					for(end = index; end < count && DrawBatch::sameState(batch.get(end), command) && batch.get(end).layer == command.layer; end++);
+
+					applyForeground(gtext, 0UL);
+					for(int i = index; i < end; i++)
+					{
+						BatchCommand& str = batch.get(i);
+						renderOutline(batch.getText(str), str.length, str.width, str.x, str.y);
+					}
+
+					applyForeground(gtext, command.colour);
+					for(int i = index; i < end; i++)
+					{
+						BatchCommand& str = batch.get(i);
+						XDrawString(display, pixmap, gtext, str.x, str.y, batch.getText(str), str.length);
+					}
+				}
+				break;
+			case BATCH_CLEAR:
+				// clears are only recorded into snapshots, which present them as fills
+				break;
+			}
+
+			index = end;
+		}
+
+		// leave the foreground colors as the caller set them; the clip state is applied when next needed.
+		// A color that was unknown, as after invalidateGraphicState, cannot be restored, so the color
+		// last set by the batch is kept, and the cache still matches the context.
+		if(drawColour != UNKNOWN_STATE)
+		{
+			applyForeground(gdraw, drawColour);
+		}
+		if(textColour != UNKNOWN_STATE)
+		{
+			applyForeground(gtext, textColour);
+		}
+		for(size_t i = 0; i < contexts.size(); i++)
+		{
+			applyForeground(contexts[i], batch_colours[i]);
+		}
+
+		batch.clear();
+		batch_colours.clear();
+	}
+
+	/// Sends the clip state of the sprite graphics context to the server, for callers that draw with
+	///  the context directly.
+	void syncGraphicState(void)
+	{
+		applyClip(clip_mask, clip_x, clip_y);
+	}
+
+	/// Forgets the cached state of the owned graphics contexts, for callers that changed the contexts
+	///  directly. The next state change of each kind is always sent.
+	void invalidateGraphicState(void)
+	{
+		for(int i = 0; i < 2; i++)
+		{
+			gstate[i].gc = gcontext[i];
+			gstate[i].foreground = UNKNOWN_STATE;
+			gstate[i].mask = UNKNOWN_STATE;
+			gstate[i].originX = INT_MIN;
+			gstate[i].originY = INT_MIN;
+			gstate[i].font = UNKNOWN_STATE;
+		}
+	}
+
+	/// Returns the number of graphics context state changes sent to the server during the last frame.
+	///  @returns The number of state change requests.
+	int getStateChanges(void)
+	{
+		return frame_changes;
+	}
+
+	/// Returns the number of graphics context state changes skipped during the last frame, because
+	///  the context already held the value.
+	///  @returns The number of requests avoided.
+	int getRequestsAvoided(void)
+	{
+		return frame_avoided;
+	}
+
+	/// Returns true if draw calls are currently being batched, false otherwise.
+	///  @returns True if a batch is open, false otherwise.
+	bool isBatching(void)
+	{
+		return batching;
+	}
+
+	/// Begins recording the draw calls made on this thread into a snapshot of a frame, so that another
+	///  thread can present it with presentSnapshot while this one moves on to the next frame. Recorded
+	///  calls are moved through the camera and culled as usual, but send nothing to the server, and leave
+	///  the colors of graphics contexts to those set through setColor. Images, masks and pixmaps created
+	///  while recording wait for a snapshot being presented to finish, and those released wait until
+	///  every snapshot that may draw them has been presented.
+	///  @snapshot The snapshot to record into, which is emptied first.
+	void beginRecording(DrawBatch* snapshot)
+	{
+		snapshot->clear();
+		recording() = snapshot;
+		frames_recorded++;
+	}
+
+	/// Ends recording on this thread. Draw calls made afterwards are drawn again.
+	void endRecording(void)
+	{
+		recording() = NULL;
+	}
+
+	/// Returns true if draw calls made on this thread are being recorded, false otherwise.
+	///  @returns True if a snapshot is being recorded, false otherwise.
+	bool isRecording(void)
+	{
+		return recording() != NULL;
+	}
+
+	/// Draws a recorded snapshot into the buffer and presents it, as its draw calls followed by flush
+	///  would. Snapshots must be presented in the order they were recorded.
+	///  @snapshot The snapshot, which must not be recorded into until it has been presented.
+	void presentSnapshot(DrawBatch* snapshot)
+	{
+		std::lock_guard<std::mutex> lock(display_mutex);
+
+		// the X backend sorts the commands by state like any other batch, when flush ends it
+		beginBatch();
+
+		int count = snapshot->getCount();
+		for(int i = 0; i < count; i++)
+		{
+			BatchCommand& command = snapshot->get(i);
+			if(command.type == BATCH_CLEAR)
+			{
+				replayClear(command.colour);
+			}
+			else if(compositor == NULL && command.type == BATCH_STRING)
+			{
+				batch.add(command, snapshot->getText(command), command.length);
+			}
+			else if(compositor == NULL)
+			{
+				batch.add(command);
+			}
+			else
+			{
+				replaySoftware(snapshot, command);
+			}
+		}
+
+		flush();
+
+		frames_presented++;
+		freeRetired(frames_presented);
+	}
+
+	/// Releases every image and pixmap released while recording, once no recorded snapshot is left to
+	///  present.
+	void releaseRetired(void)
+	{
+		std::lock_guard<std::mutex> lock(display_mutex);
+		freeRetired(frames_recorded);
+	}
+
+	/// Opens the window.
+	void openw(void)
+	{
+		XMapRaised(display, window);		
+		XFlush(display);
+
+		// let server get set up before sending drawing commands
+		wait(2);	
+	}
+
+	/// Closes the current window and display.
+	void close(void)
+	{
+		// queued loads are decoded to the end, as the pool drops tasks it has not started, then discarded
+		if(load_pool != NULL)
+		{
+			{
+				std::unique_lock<std::mutex> lock(load_mutex);
+				load_done.wait(lock, [this] { return (int)load_completed.size() >= loads_requested - loads_completed; });
+			}
+			delete load_pool;
+			load_pool = NULL;
+
+			for(size_t i = 0; i < load_completed.size(); i++)
+			{
+				free(load_completed[i]->pixels);
+				delete load_completed[i];
+			}
+			load_completed.clear();
+		}
+
+		// the render workers are joined before the buffer they rasterize into is freed
+		delete render_pool;
+		render_pool = NULL;
+
+		// the software backbuffer may live in shared memory, which is detached while the display is open
+		delete compositor;
+		compositor = NULL;
+		if(backbuffer != NULL)
+		{
+			destroyImage(backbuffer);
+			backbuffer = NULL;
+		}
+
+		releaseBackground();
+		delete damage;
+		delete previous_damage;
+		damage = NULL;
+		previous_damage = NULL;
+
+		XCloseDisplay(display);
+		display = NULL;
+	}
+
+	/// Sleeps the game for a period of milliseconds.
+	///  @time The number of milliseconds to sleep the game.
+	void wait(long time)
+	{
+		usleep(time);
+	}
+
+	/// Returns the window size hints.
+	///  @returns The window size hints.
+	XSizeHints getWindowHints(void)
+	{
+		return hints;
+	}
+
+	/// Returns the current Keyboard state.
+	///  @returns The current keyboard state. 
+	KeyboardState* getKeyboardState(void)
+	{
+		return keyboard;
+	}
+
+	/// Returns the current Mouse state.
+	///  @returns The current mouse state. 
+	MouseState* getMouseState(void)
+	{
+		return mouse;
+	}
+
+	/// Gets the current display device.
+	///  @returns The current display device.
+	Display* getDisplay(void)
+	{
+		return display;
+	}
+
+	/// Gets the underlying operating system window.
+	///  @returns The application window.
+	Window getWindow(void)
+	{
+		return window;
+	}
+
+	/// Gets the screen number for the application.
+	///  @returns The screen number.
+	int getScreen(void)
+	{
+		return screen;
+	}
+
+	/// Creates a graphic context from the current display.
+	///  @returns A newly created graphic context.
+	GC createGraphicContext(void)
+	{
+		std::unique_lock<std::mutex> lock = lockDisplay();
+		return XCreateGC(display, window, 0, 0);
+	}
+
+	/// Gets the collection of graphic contexts for the application.
+	///  @returns A collection of graphic contexts.
+	GC* getGraphicDevices(void)
+	{
+		return gcontext;
+	}
+
+	/// Returns the graphic context associated with image-based rendering.
+	///  @returns The graphic context responsible for image-based rendering.
+	GC getGraphicContext(void)
+	{
+		return gcontext[0];
+	}
+
+	/// Returns the graphics context associated with text-based rendering.
+	///  @returns The graphic context responsible for text-based rendering.
+	GC getTextDevice(void)
+	{
+		return gcontext[1];
+	}
+
+	/// Returns the default font used when rendering text.
+	///  @returns A graphics font.
+	XFontStruct* getDefaultFont(void)
+	{
+		return font;
+	}
+
+	/// Returns the render-target surface for the application.
+	///  @returns The render-target surface of the application.
+	Pixmap getImageBuffer(void)
+	{
+		return pixmap;
+	}
+
+	/// Returns the window dimensions of a render-target surface.
+	///  @returns The dimensions of the image buffer.
+	Rectangle* getGraphicBounds(void)
+	{
+		return pix_bounds;
+	}
+
+	/// Returns the camera, which moves every draw call from world to screen coordinates.
+	///  @returns The camera.
+	Camera* getCamera(void)
+	{
+		return &camera;
+	}
+
+	/// Returns the window width of a render-target surface.
+	///  @returns The width of the image buffer.
+	float getImageWidth(void)
+	{
+		return pix_bounds->getWidth();
+	}
+
+	/// Returns the window height of a render-target surface.
+	///  @returns The height of the image buffer.
+	float getImageHeight(void)
+	{
+		return pix_bounds->getHeight();
+	}
+
+	/// Sets the icon of the window for initialization.
+	void setIcon(const char* wicon)
+	{
+		icon = wicon;
+	}
+
+	/// Returns the backend used to render frames.
+	///  @returns The render backend.
+	RENDER_BACKEND getRenderBackend(void)
+	{
+		return backend;
+	}
+
+	/// Sets the backend used to render frames. Must be called before initialization.
+	///  @value The value to set.
+	void setRenderBackend(RENDER_BACKEND value)
+	{
+		backend = value;
+	}
+
+	/// Sets the number of worker threads rasterizing frames with the software backend, in addition to
+	///  the calling thread. Must be called before initialization.
+	///  @value The value to set, or -1 to use one worker less than the number of cores.
+	void setRenderThreads(int value)
+	{
+		render_threads = value;
+	}
+
+	/// Sets the color treated as transparent instead of the image alpha, by the software backend and by
+	///  the clipping masks built afterwards.
+	///  @key The transparent color.
+	void setColorKey(unsigned long key)
+	{
+		color_keyed = true;
+		color_key = key & Blitter::COLOR_MASK;
+		if(compositor != NULL)
+		{
+			compositor->setColorKey(key);
+		}
+	}
+
+	/// Clears the color key, so images are blended and masked with their alpha.
+	void clearColorKey(void)
+	{
+		color_keyed = false;
+		if(compositor != NULL)
+		{
+			compositor->clearColorKey();
+		}
+	}
+
+	/// Returns true if images are uploaded through shared memory, false otherwise.
+	///  @returns True if shared memory is in use, false otherwise.
+	bool isSharedMemory(void)
+	{
+		return shm_available;
+	}
+
+	/// Sets whether shared memory images should be used when the display supports them.
+	///  Must be called before initialization.
+	///  @value The value to set.
+	void setSharedMemory(bool value)
+	{
+		shm_enabled = value;
+	}
+
+	/// Sets the title of the window for initialization.
+	void setTitle(const char* wtitle)
+	{
+		title = wtitle;
+	}
+
+private:
+	/// Marks a cached graphics context value that is not known.
+	static const unsigned long UNKNOWN_STATE = ~0UL;
+
+	/// LoadRequest
+	///  An image requested to load in the background.
+	struct LoadRequest
+	{
+		std::string filename;
+		XImage** img;
+		Pixmap* pxm;
+
+		// How the mask is built, captured when the request is made
+		bool masked;
+		bool keyed;
+		uint32_t key;
+
+		// Decoded by the load worker
+		char* pixels;
+		int width;
+		int height;
+		std::vector<unsigned char> mask;
+		bool failed;
+	};
+
+	/// GraphicState
+	///  The values last sent to the server for a graphics context.
+	struct GraphicState
+	{
+		GC gc;
+		unsigned long foreground;
+		Pixmap mask;
+		int originX;
+		int originY;
+		Font font;
+	};
+
+	/// RetiredResource
+	///  An image or pixmap released while recording, and the last snapshot that may draw it.
+	struct RetiredResource
+	{
+		XImage* image;
+		Pixmap surface;
+		unsigned long frame;
+	};
+
+	/// Returns the snapshot the calling thread records into.
+	///  @returns The snapshot, or NULL if the thread draws its calls.
+	static DrawBatch*& recording(void)
+	{
+		static thread_local DrawBatch* snapshot = NULL;
+		return snapshot;
+	}
+
+	/// Returns the batch deferred draw calls are added to: the snapshot while recording, otherwise the batch.
+	///  @returns The batch.
+	DrawBatch& getBatch(void)
+	{
+		DrawBatch* snapshot = recording();
+		return snapshot != NULL ? *snapshot : batch;
+	}
+
+	/// Begins a batch for a list of draw calls, unless one is open or the calls are recorded.
+	///  @returns True if the batch was begun, and must be ended by the caller.
+	bool openBatch(void)
+	{
+		if(isRecording() || batching)
+		{
+			return false;
+		}
+
+		beginBatch();
+		return true;
+	}
+
+	/// Locks the display against a snapshot being presented, when called while recording. The pipelined
+	///  game loop records for the whole of each simulated frame, update included, so every call the
+	///  simulation thread makes that reaches the display is serialized with presentSnapshot.
+	///  @returns The lock, which owns nothing when not recording.
+	std::unique_lock<std::mutex> lockDisplay(void)
+	{
+		if(isRecording())
+		{
+			return std::unique_lock<std::mutex>(display_mutex);
+		}
+		return std::unique_lock<std::mutex>();
+	}
+
+	/// Releases an image or pixmap once the snapshot being recorded has been presented.
+	///  @img The image, or NULL.
+	///  @surface The pixmap, or None.
+	void retire(XImage* img, Pixmap surface)
+	{
+		std::lock_guard<std::mutex> lock(display_mutex);
+		RetiredResource resource = { img, surface, frames_recorded };
+		retired.push_back(resource);
+	}
+
+	/// Releases the retired images and pixmaps that no snapshot left to present may draw. The display
+	///  lock must be held.
+	///  @frame The last snapshot presented.
+	void freeRetired(unsigned long frame)
+	{
+		size_t count = 0;
+		while(count < retired.size() && retired[count].frame <= frame)
+		{
+			if(retired[count].image != NULL)
+			{
+				destroyImage(retired[count].image);
+			}
+			freeSurface(retired[count].surface);
+			count++;
+		}
+		retired.erase(retired.begin(), retired.begin() + count);
+	}
+
+	/// Clears the buffer for a recorded clear, as clear would have with the recorded color.
+	///  @colour The color of the sprite graphics context when the clear was recorded.
+	void replayClear(unsigned long colour)
+	{
+		if(compositor != NULL)
+		{
+			compositor->clear(colour);
+			return;
+		}
+
+		// damaged areas are filled with the color the context holds when the batch ends
+		applyForeground(gdraw, colour);
+		if(damage_tracking)
+		{
+			clear_pending = true;
+			return;
+		}
+
+		BatchCommand command = createCommand(BATCH_FILL, gdraw, 0, 0, getImageWidth(), getImageHeight());
+		command.colour = colour;
+		batch.add(command);
+	}
+
+	/// Draws a recorded command through the software backend.
+	///  @snapshot The snapshot holding the command.
+	///  @command The command.
+	void replaySoftware(DrawBatch* snapshot, const BatchCommand& command)
+	{
+		switch(command.type)
+		{
+		case BATCH_IMAGE:
+		case BATCH_SURFACE:
+			// the software backend has no surfaces, so only images are recorded
+			blit(command.image, command.posx, command.posy, command.x, command.y, command.width, command.height);
+			break;
+		case BATCH_FILL:
+			compositor->fill(command.x, command.y, command.width, command.height, command.colour);
+			break;
+		case BATCH_OUTLINE:
+			{
+				XRectangle rect = { (short)command.x, (short)command.y, (unsigned short)command.width, (unsigned short)command.height };
+				outlineRectangle(command.gc, rect, command.colour);
+			}
+			break;
+		case BATCH_SEGMENT:
+			{
+				XSegment segment = { (short)command.x, (short)command.y, (short)command.posx, (short)command.posy };
+				drawSegment(command.gc, segment, command.colour);
+			}
+			break;
+		case BATCH_STRING:
+			{
+				TextItem item = { std::string(snapshot->getText(command), command.length), command.x, command.y, command.colour };
+				texts.push_back(item);
+			}
+			break;
+		case BATCH_CLEAR:
+			break;
+		}
+	}
+
+	/// Draws a string with a one pixel black outline into the image buffer.
+	///  @str A text string.
+	///  @x The x-coordinate (in screen coordinates) to draw the string.
+	///  @y The y-coordinate (in screen coordinates) to draw the string.
+	///  @colour The color to tint a string.
+	void renderString(const std::string& str, int x, int y, unsigned long colour)
+	{
+		const char* text = str.c_str();
+		int length = str.length();
+		GC gc_text = getTextDevice();
+
+		applyForeground(gc_text, 0UL);
+		renderOutline(text, length, XTextWidth(font, text, length), x, y);
+
+		applyForeground(gc_text, colour);
+		XDrawString(display, pixmap, gc_text, x, y,	text, length);
+	}
+
+	/// Draws the outline of a string with the current text color, by drawing it offset by a pixel in
+	///  every direction. Each row of offsets is a single request.
+	///  @text The text of the string.
+	///  @length The length of the text.
+	///  @width The width of the string in pixels.
+	///  @x The x-coordinate (in screen coordinates) of the string.
+	///  @y The y-coordinate (in screen coordinates) of the string.
+	void renderOutline(const char* text, int length, int width, int x, int y)
+	{
+		// each item starts where the previous one ended, plus its delta
+		XTextItem items[3];
+		for(int i = 0; i < 3; i++)
+		{
+			items[i].chars = (char*)text;
+			items[i].nchars = length;
+			items[i].delta = 1 - width;
+			items[i].font = None;
+		}
+		items[0].delta = 0;
+
+		XDrawText(display, pixmap, gtext, x - 1, y - 1, items, 3);
+		XDrawText(display, pixmap, gtext, x - 1, y + 1, items, 3);
+
+		// the middle of the center row is covered by the string itself
+		items[1].delta = 2 - width;
+		XDrawText(display, pixmap, gtext, x - 1, y, items, 2);
+	}
+
+	/// Adds the area of every batched draw call to the damage of the frame, and erases the damage of
+	///  this frame and the last if a clear is pending.
+	void recordDamage(void)
+	{
+		int count = batch.getCount();
+		for(int i = 0; i < count; i++)
+		{
+			BatchCommand& command = batch.get(i);
+			damage->add(command.left, command.top, command.right, command.bottom);
+		}
+
+		if(!clear_pending)
+		{
+			return;
+		}
+		clear_pending = false;
+
+		DamageRegion region = *previous_damage;
+		region.unite(*damage);
+		region.getRectangles(damage_rects);
+		if(damage_rects.empty())
+		{
+			return;
+		}
+
+		applyClipMask(gdraw, None);
+		if(background != None)
+		{
+			for(size_t i = 0; i < damage_rects.size(); i++)
+			{
+				XRectangle& rect = damage_rects[i];
+				XCopyArea(display, background, pixmap, gdraw, rect.x, rect.y, rect.width, rect.height, rect.x, rect.y);
+			}
+		}
+		else
+		{
+			XFillRectangles(display, pixmap, gdraw, &damage_rects[0], damage_rects.size());
+		}
+	}
+
+	/// Copies the damage of this frame and the last to the window, then starts the damage of a new frame.
+	void presentDamage(void)
+	{
+		if(capture_pending)
+		{
+			if(background == None)
+			{
+				background = XCreatePixmap(display, window, getImageWidth(), getImageHeight(), DefaultDepth(display, screen));
+			}
+			XCopyArea(display, pixmap, background, gdraw, 0, 0, getImageWidth(), getImageHeight(), 0, 0);
+			capture_pending = false;
+		}
+
+		DamageRegion* region = previous_damage;
+		region->unite(*damage);
+		region->getRectangles(damage_rects);
+
+		int left = pix_bounds->getLeft();
+		int top = pix_bounds->getTop();
+		for(size_t i = 0; i < damage_rects.size(); i++)
+		{
+			XRectangle& rect = damage_rects[i];
+			XCopyArea(display, pixmap, window, gdraw, rect.x, rect.y, rect.width, rect.height, left + rect.x, top + rect.y);
+		}
+
+		// this frame's damage becomes the last frame's damage
+		previous_damage = damage;
+		damage = region;
+		damage->clear();
+	}
+
+	/// Creates a batch command covering a rectangle of the screen.
+	///  @type The type of the command.
+	///  @gc The graphics context of the command.
+	///  @x The x-coordinate (in screen coordinates) of the command.
+	///  @y The y-coordinate (in screen coordinates) of the command.
+	///  @width The width of the command.
+	///  @height The height of the command.
+	///  @returns The command.
+	BatchCommand createCommand(BATCH_COMMAND type, GC gc, int x, int y, int width, int height)
+	{
+		BatchCommand command;
+		command.type = type;
+		command.gc = gc;
+		command.image = NULL;
+		command.surface = None;
+		command.posx = 0;
+		command.posy = 0;
+		command.mask = None;
+		command.originX = 0;
+		command.originY = 0;
+		command.x = x;
+		command.y = y;
+		command.width = width;
+		command.height = height;
+		command.colour = 0;
+		command.left = x;
+		command.top = y;
+		command.right = x + width;
+		command.bottom = y + height;
+		return command;
+	}
+
+	/// Records a rectangle into the batch with the clip state of its graphics context.
+	///  @type Either BATCH_FILL or BATCH_OUTLINE.
+	///  @gc The graphics context to draw with.
+	///  @x The x-coordinate of the rectangle.
+	///  @y The y-coordinate of the rectangle.
+	///  @width The width of the rectangle.
+	///  @height The height of the rectangle.
+	///  @colour The color to draw with.
+	void recordRectangle(BATCH_COMMAND type, GC gc, int x, int y, unsigned int width, unsigned int height, unsigned long colour)
+	{
+		BatchCommand command = createCommand(type, gc, x, y, width, height);
+		command.colour = colour;
+		if(type == BATCH_OUTLINE)
+		{
+			command.right++;
+			command.bottom++;
+		}
+		recordClip(command);
+		getBatch().add(command);
+	}
+
+	/// Records a line segment into the batch with the clip state of its graphics context.
+	///  @gc The graphics context to draw with.
+	///  @segment The segment.
+	///  @colour The color to draw with.
+	void recordSegment(GC gc, const XSegment& segment, unsigned long colour)
+	{
+		BatchCommand command = createCommand(BATCH_SEGMENT, gc, segment.x1, segment.y1, 0, 0);
+		command.posx = segment.x2;
+		command.posy = segment.y2;
+		command.colour = colour;
+
+		// thin lines include both end points
+		command.left = std::min(segment.x1, segment.x2);
+		command.top = std::min(segment.y1, segment.y2);
+		command.right = std::max(segment.x1, segment.x2) + 1;
+		command.bottom = std::max(segment.y1, segment.y2) + 1;
+		recordClip(command);
+		getBatch().add(command);
+	}
+
+	/// Records a string into the batch.
+	///  @text The text of the string.
+	///  @length The length of the text.
+	///  @x The x-coordinate (in screen coordinates) of the string.
+	///  @y The y-coordinate (in screen coordinates) of the string.
+	///  @colour The color to tint the string.
+	void recordString(const char* text, int length, int x, int y, unsigned long colour)
+	{
+		int direction, ascent, descent;
+		XCharStruct overall;
+		XTextExtents(font, text, length, &direction, &ascent, &descent, &overall);
+
+		BatchCommand command = createCommand(BATCH_STRING, gtext, x, y, overall.width, 0);
+		command.colour = colour;
+
+		// the outline extends the ink of the string by a pixel on every side
+		command.left = x + overall.lbearing - 1;
+		command.top = y - overall.ascent - 1;
+		command.right = x + overall.rbearing + 1;
+		command.bottom = y + overall.descent + 1;
+		getBatch().add(command, text, length);
+	}
+
+	/// Gives a command drawn with the sprite graphics context the clip state left by the last call.
+	///  @command The command.
+	void recordClip(BatchCommand& command)
+	{
+		if(command.gc == gdraw)
+		{
+			command.mask = clip_mask;
+			command.originX = clip_x;
+			command.originY = clip_y;
+		}
+	}
+
+	/// Draws a rectangle outline in a color, through the compositor or the batch.
+	///  @gc The graphics context to draw with.
+	///  @rect The rectangle.
+	///  @colour The color to draw with.
+	void outlineRectangle(GC gc, const XRectangle& rect, unsigned long colour)
+	{
+		if(compositor != NULL && !isRecording())
+		{
+			// X outlines cover width + 1 by height + 1 pixels
+			compositor->fill(rect.x, rect.y, rect.width + 1, 1, colour);
+			compositor->fill(rect.x, rect.y + rect.height, rect.width + 1, 1, colour);
+			compositor->fill(rect.x, rect.y + 1, 1, (int)rect.height - 1, colour);
+			compositor->fill(rect.x + rect.width, rect.y + 1, 1, (int)rect.height - 1, colour);
+			return;
+		}
+
+		recordRectangle(BATCH_OUTLINE, gc, rect.x, rect.y, rect.width, rect.height, colour);
+	}
+
+	/// Fills a rectangle in a color, through the compositor or the batch.
+	///  @gc The graphics context to draw with.
+	///  @rect The rectangle.
+	///  @colour The color to draw with.
+	void fillRectangle(GC gc, const XRectangle& rect, unsigned long colour)
+	{
+		if(compositor != NULL && !isRecording())
+		{
+			compositor->fill(rect.x, rect.y, rect.width, rect.height, colour);
+			return;
+		}
+
+		recordRectangle(BATCH_FILL, gc, rect.x, rect.y, rect.width, rect.height, colour);
+	}
+
+	/// Draws a list of rectangle outlines in screen coordinates, in the color of the graphic context.
+	///  @gc The graphics context to draw with.
+	///  @rects The rectangles.
+	///  @count The number of rectangles.
+	void submitOutlines(GC gc, XRectangle* rects, int count)
+	{
+		if(count <= 0)
+		{
+			return;
+		}
+
+		if(compositor != NULL || isRecording() || batching)
+		{
+			unsigned long colour = getForeground(gc);
+			for(int i = 0; i < count; i++)
+			{
+				outlineRectangle(gc, rects[i], colour);
+			}
+			return;
+		}
+
+		if(gc == gdraw)
+		{
+			syncGraphicState();
+		}
+
+		XDrawRectangles(display, pixmap, gc, rects, count);
+	}
+
+	/// Fills a list of rectangles in screen coordinates, in the color of the graphic context.
+	///  @gc The graphics context to draw with.
+	///  @rects The rectangles.
+	///  @count The number of rectangles.
+	void submitFills(GC gc, XRectangle* rects, int count)
+	{
+		if(count <= 0)
+		{
+			return;
+		}
+
+		if(compositor != NULL || isRecording() || batching)
+		{
+			unsigned long colour = getForeground(gc);
+			for(int i = 0; i < count; i++)
+			{
+				fillRectangle(gc, rects[i], colour);
+			}
+			return;
+		}
+
+		if(gc == gdraw)
+		{
+			syncGraphicState();
+		}
+
+		XFillRectangles(display, pixmap, gc, rects, count);
+	}
+
+	/// Draws a list of line segments in screen coordinates, in the color of the graphic context.
+	///  @gc The graphics context to draw with.
+	///  @segments The segments.
+	///  @count The number of segments.
+	void submitSegments(GC gc, XSegment* segments, int count)
+	{
+		if(count <= 0)
+		{
+			return;
+		}
+
+		if(compositor != NULL || isRecording() || batching)
+		{
+			unsigned long colour = getForeground(gc);
+			for(int i = 0; i < count; i++)
+			{
+				drawSegment(gc, segments[i], colour);
+			}
+			return;
+		}
+
+		if(gc == gdraw)
+		{
+			syncGraphicState();
+		}
+
+		XDrawSegments(display, pixmap, gc, segments, count);
+	}
+
+	/// Draws a line segment in a color, through the compositor or the batch.
+	///  @gc The graphics context to draw with.
+	///  @segment The segment.
+	///  @colour The color to draw with.
+	void drawSegment(GC gc, const XSegment& segment, unsigned long colour)
+	{
+		if(compositor == NULL || isRecording())
+		{
+			recordSegment(gc, segment, colour);
+			return;
+		}
+
+		// the line is stepped along its major axis, and every run of pixels sharing the minor
+		// coordinate is filled as one span
+		int x = segment.x1, y = segment.y1;
+		int dx = std::abs(segment.x2 - x), dy = std::abs(segment.y2 - y);
+		int sx = segment.x2 < x ? -1 : 1, sy = segment.y2 < y ? -1 : 1;
+		bool steep = dy > dx;
+		int major = steep ? dy : dx;
+		int minor = steep ? dx : dy;
+		int error = major / 2;
+		int spanX = x, spanY = y;
+
+		for(int i = 0; i < major; i++)
+		{
+			int lastX = x, lastY = y;
+			if(steep) y += sy; else x += sx;
+
+			error -= minor;
+			if(error < 0)
+			{
+				error += major;
+				fillSpan(spanX, spanY, lastX, lastY, colour);
+				if(steep) x += sx; else y += sy;
+				spanX = x;
+				spanY = y;
+			}
+		}
+		fillSpan(spanX, spanY, x, y, colour);
+	}
+
+	/// Fills the compositor span between two pixels of a row or a column, inclusive.
+	void fillSpan(int x1, int y1, int x2, int y2, unsigned long colour)
+	{
+		compositor->fill(std::min(x1, x2), std::min(y1, y2), std::abs(x2 - x1) + 1, std::abs(y2 - y1) + 1, colour);
+	}
+
+	/// Determines whether a rectangle can be submitted in the same request as another.
+	bool mergeable(const BatchCommand& rect, const BatchCommand& first)
+	{
+		return DrawBatch::sameState(rect, first) && (rect.mask == None || (rect.originX == first.originX && rect.originY == first.originY));
+	}
+
+	/// Returns the cached state of a graphics context owned by the XInfo.
+	///  @gc The graphics context.
+	///  @returns The cached state, or NULL if the context is not owned by the XInfo.
+	GraphicState* findState(GC gc)
+	{
+		for(int i = 0; i < 2; i++)
+		{
+			if(gstate[i].gc == gc)
+			{
+				return &gstate[i];
+			}
+		}
+		return NULL;
+	}
+
+	/// Sets the foreground color of a graphics context, unless it already holds it.
+	///  @gc The graphics context.
+	///  @colour The color to set.
+	void applyForeground(GC gc, unsigned long colour)
+	{
+		// contexts created by the caller are compared against the client-side copy Xlib keeps
+		GraphicState* state = findState(gc);
+		unsigned long current = state != NULL ? state->foreground : getForeground(gc);
+		if(current == colour)
+		{
+			requests_avoided++;
+			return;
+		}
+
+		XSetForeground(display, gc, colour);
+		requests_issued++;
+		if(state != NULL)
+		{
+			state->foreground = colour;
+		}
+	}
+
+	/// Sets the clip mask of a graphics context, unless it already holds it.
+	///  @gc The graphics context.
+	///  @mask The clip mask to set.
+	void applyClipMask(GC gc, Pixmap mask)
+	{
+		GraphicState* state = findState(gc);
+		if(state != NULL && state->mask == mask)
+		{
+			requests_avoided++;
+			return;
+		}
+
+		XSetClipMask(display, gc, mask);
+		requests_issued++;
+		if(state != NULL)
+		{
+			state->mask = mask;
+		}
+	}
+
+	/// Sets the clip origin of a graphics context, unless it already holds it.
+	///  @gc The graphics context.
+	///  @originX The clip x-origin to set.
+	///  @originY The clip y-origin to set.
+	void applyClipOrigin(GC gc, int originX, int originY)
+	{
+		GraphicState* state = findState(gc);
+		if(state != NULL && state->originX == originX && state->originY == originY)
+		{
+			requests_avoided++;
+			return;
+		}
+
+		XSetClipOrigin(display, gc, originX, originY);
+		requests_issued++;
+		if(state != NULL)
+		{
+			state->originX = originX;
+			state->originY = originY;
+		}
+	}
+
+	/// Sets the font of a graphics context, unless it already holds it.
+	///  @gc The graphics context.
+	///  @value The font to set.
+	void applyFont(GC gc, Font value)
+	{
+		GraphicState* state = findState(gc);
+		if(state != NULL && state->font == value)
+		{
+			requests_avoided++;
+			return;
+		}
+
+		XSetFont(display, gc, value);
+		requests_issued++;
+		if(state != NULL)
+		{
+			state->font = value;
+		}
+	}
+
+	/// Sets the clip state of the sprite graphics context.
+	///  @mask The clip mask to set.
+	///  @originX The clip x-origin to set.
+	///  @originY The clip y-origin to set.
+	void applyClip(Pixmap mask, int originX, int originY)
+	{
+		applyClipMask(gdraw, mask);
+
+		// the origin only matters while a mask is set
+		if(mask != None)
+		{
+			applyClipOrigin(gdraw, originX, originY);
+		}
+	}
+
+	/// Records the clip state that the sprite graphics context holds after a draw call.
+	///  @mask The clip mask.
+	///  @originX The clip x-origin.
+	///  @originY The clip y-origin.
+	void setClipState(Pixmap mask, int originX, int originY)
+	{
+		clip_mask = mask;
+		clip_x = originX;
+		clip_y = originY;
+	}
+
+	/// Moves a rectangle from world to screen coordinates through the camera.
+	///  @x The x-coordinate of the rectangle, moved to screen coordinates.
+	///  @y The y-coordinate of the rectangle, moved to screen coordinates.
+	///  @width The width of the rectangle.
+	///  @height The height of the rectangle.
+	///  @returns True if any of the rectangle is on the screen, false if it can be skipped.
+	bool toScreen(int& x, int& y, int width, int height)
+	{
+		x -= camera.getOffsetX();
+		y -= camera.getOffsetY();
+		return x < camera.getWidth() && y < camera.getHeight() && x + width > 0 && y + height > 0;
+	}
+
+	/// Moves a rectangle from world to screen coordinates through the camera. Outlines cover one pixel
+	///  more than their size on each axis. The part of the rectangle beyond the screen is cut off, so the
+	///  result fits an XRectangle however far the rectangle reaches.
+	///  @x The x-coordinate of the rectangle, in world coordinates.
+	///  @y The y-coordinate of the rectangle, in world coordinates.
+	///  @width The width of the rectangle.
+	///  @height The height of the rectangle.
+	///  @outline True if the rectangle is drawn as an outline.
+	///  @rect The rectangle in screen coordinates.
+	///  @returns True if any of the rectangle is on the screen, false if it can be skipped.
+	bool toScreen(int x, int y, unsigned int width, unsigned int height, bool outline, XRectangle& rect)
+	{
+		if(!toScreen(x, y, width + outline, height + outline))
+		{
+			return false;
+		}
+
+		// edges beyond the screen are moved to just past it, where they are not seen either
+		int left = std::max(x, -1);
+		int top = std::max(y, -1);
+		int right = (int)std::min((long)x + width, (long)camera.getWidth() + 1);
+		int bottom = (int)std::min((long)y + height, (long)camera.getHeight() + 1);
+
+		rect.x = (short)left;
+		rect.y = (short)top;
+		rect.width = (unsigned short)(right - left);
+		rect.height = (unsigned short)(bottom - top);
+		return true;
+	}
+
+	/// Moves a rectangle from world to screen coordinates through the camera.
+	///  @rect The rectangle, moved to screen coordinates.
+	///  @outline True if the rectangle is drawn as an outline.
+	///  @returns True if any of the rectangle is on the screen, false if it can be skipped.
+	bool toScreen(XRectangle& rect, bool outline)
+	{
+		return toScreen(rect.x, rect.y, rect.width, rect.height, outline, rect);
+	}
+
+	/// Moves a line segment from world to screen coordinates through the camera. A segment reaching
+	///  beyond the range of an XSegment is cut at the edges of the screen.
+	///  @x1 The x-coordinate of the first point, in world coordinates.
+	///  @y1 The y-coordinate of the first point, in world coordinates.
+	///  @x2 The x-coordinate of the second point, in world coordinates.
+	///  @y2 The y-coordinate of the second point, in world coordinates.
+	///  @segment The segment in screen coordinates.
+	///  @returns True if the segment may cross the screen, false if it can be skipped.
+	bool toScreen(int x1, int y1, int x2, int y2, XSegment& segment)
+	{
+		int x = std::min(x1, x2), y = std::min(y1, y2);
+		if(!toScreen(x, y, std::abs(x2 - x1) + 1, std::abs(y2 - y1) + 1))
+		{
+			return false;
+		}
+
+		x1 -= camera.getOffsetX();
+		x2 -= camera.getOffsetX();
+		y1 -= camera.getOffsetY();
+		y2 -= camera.getOffsetY();
+
+		if(std::min(std::min(x1, x2), std::min(y1, y2)) < SHRT_MIN || std::max(std::max(x1, x2), std::max(y1, y2)) > SHRT_MAX)
+		{
+			// the segment is clipped against the screen by its parameter along the line (Liang-Barsky)
+			double dx = (double)x2 - x1, dy = (double)y2 - y1;
+			double p[4] = { -dx, dx, -dy, dy };
+			double q[4] = { x1 + 1.0, camera.getWidth() - (double)x1, y1 + 1.0, camera.getHeight() - (double)y1 };
+			double enter = 0, leave = 1;
+			for(int i = 0; i < 4; i++)
+			{
+				if(p[i] == 0)
+				{
+					if(q[i] < 0)
+						return false;
+				}
+				else if(p[i] < 0)
+				{
+					enter = std::max(enter, q[i] / p[i]);
+				}
+				else
+				{
+					leave = std::min(leave, q[i] / p[i]);
+				}
+			}
+			if(enter > leave)
+			{
+				return false;
+			}
+
+			int startX = x1 + (int)floor(enter * dx + 0.5), startY = y1 + (int)floor(enter * dy + 0.5);
+			x2 = x1 + (int)floor(leave * dx + 0.5);
+			y2 = y1 + (int)floor(leave * dy + 0.5);
+			x1 = startX;
+			y1 = startY;
+		}
+
+		segment.x1 = (short)x1;
+		segment.y1 = (short)y1;
+		segment.x2 = (short)x2;
+		segment.y2 = (short)y2;
+		return true;
+	}
+
+	/// Moves a line segment from world to screen coordinates through the camera.
+	///  @segment The segment, moved to screen coordinates.
+	///  @returns True if the segment may cross the screen, false if it can be skipped.
+	bool toScreen(XSegment& segment)
+	{
+		return toScreen(segment.x1, segment.y1, segment.x2, segment.y2, segment);
+	}
+
+	/// Moves a list of rectangles to screen coordinates, leaving out those off the screen.
+	///  @rects The rectangles, in world coordinates.
+	///  @count The number of rectangles, set to the number left.
+	///  @outline True if the rectangles are drawn as outlines.
+	///  @returns The rectangles in screen coordinates, valid until the next call.
+	XRectangle* toScreen(const XRectangle* rects, int& count, bool outline)
+	{
+		screen_rects.clear();
+		for(int i = 0; i < count; i++)
+		{
+			XRectangle rect;
+			if(toScreen(rects[i].x, rects[i].y, rects[i].width, rects[i].height, outline, rect))
+			{
+				screen_rects.push_back(rect);
+			}
+		}
+
+		count = (int)screen_rects.size();
+		return count > 0 ? &screen_rects[0] : NULL;
+	}
+
+	/// Moves a list of rectangles to screen coordinates, leaving out those off the screen.
+	///  @rects The rectangles, in world coordinates.
+	///  @count The number of rectangles, set to the number left.
+	///  @outline True if the rectangles are drawn as outlines.
+	///  @returns The rectangles in screen coordinates, valid until the next call.
+	XRectangle* toScreen(const WorldRectangle* rects, int& count, bool outline)
+	{
+		screen_rects.clear();
+		for(int i = 0; i < count; i++)
+		{
+			XRectangle rect;
+			if(toScreen(rects[i].x, rects[i].y, rects[i].width, rects[i].height, outline, rect))
+			{
+				screen_rects.push_back(rect);
+			}
+		}
+
+		count = (int)screen_rects.size();
+		return count > 0 ? &screen_rects[0] : NULL;
+	}
+
+	/// Moves a list of line segments to screen coordinates, leaving out those off the screen.
+	///  @segments The segments, in world coordinates.
+	///  @count The number of segments, set to the number left.
+	///  @returns The segments in screen coordinates, valid until the next call.
+	XSegment* toScreen(const XSegment* segments, int& count)
 	{
-		XCopyArea(display, pixmap, window, gdraw,	0, 0, getImageWidth(), getImageHeight(), pix_bounds->getLeft(), pix_bounds->getTop());
+		screen_segments.clear();
+		for(int i = 0; i < count; i++)
+		{
+			XSegment segment;
+			if(toScreen(segments[i].x1, segments[i].y1, segments[i].x2, segments[i].y2, segment))
+			{
+				screen_segments.push_back(segment);
+			}
+		}
 
-		XFlush(display);
+		count = (int)screen_segments.size();
+		return count > 0 ? &screen_segments[0] : NULL;
 	}
 
-	/// Opens the window.
-	void openw(void)
+	/// Moves a list of line segments to screen coordinates, leaving out those off the screen.
+	///  @segments The segments, in world coordinates.
+	///  @count The number of segments, set to the number left.
+	///  @returns The segments in screen coordinates, valid until the next call.
+	XSegment* toScreen(const WorldSegment* segments, int& count)
 	{
-		XMapRaised(display, window);		
-		XFlush(display);
+		screen_segments.clear();
+		for(int i = 0; i < count; i++)
+		{
+			XSegment segment;
+			if(toScreen(segments[i].x1, segments[i].y1, segments[i].x2, segments[i].y2, segment))
+			{
+				screen_segments.push_back(segment);
+			}
+		}
 
-		// let server get set up before sending drawing commands
-		wait(2);	
+		count = (int)screen_segments.size();
+		return count > 0 ? &screen_segments[0] : NULL;
 	}
 
-	/// Closes the current window and display.
-	void close(void)
+	/// Draws an image with a clipping mask, in screen coordinates.
+	///  @x The x-coordinate (in screen coordinates) to draw the image.
+	///  @y The y-coordinate (in screen coordinates) to draw the image.
+	///  @posx The x-coordinate (in image coordinates) to draw the image.
+	///  @posy The y-coordinate (in image coordinates) to draw the image.
+	///  @width The width of the image to draw.
+	///  @height The height of the image to draw.
+	///  @img A pointer to the image asset to be drawn.
+	///  @mask A pointer to the clipmask of the image.
+	void drawImage(int x, int y, int posx, int posy, int width, int height, XImage* img, Pixmap mask)
 	{
-		XCloseDisplay(display);
+		if(compositor != NULL && !isRecording())
+		{
+			blit(img, posx, posy, x, y, width, height);
+			return;
+		}
+
+		int srcx = x - posx;
+		int srcy = y - posy;
+
+		if(isRecording() || batching)
+		{
+			BatchCommand command = createCommand(BATCH_IMAGE, gdraw, x, y, width, height);
+			command.image = img;
+			command.posx = posx;
+			command.posy = posy;
+			command.mask = mask;
+			command.originX = srcx;
+			command.originY = srcy;
+			getBatch().add(command);
+
+			setClipState(None, srcx, srcy);
+			return;
+		}
+
+		applyClip(mask, srcx, srcy);
+
+		putImage(img,
+			posx, posy,
+			x, y,
+			width, height);
+
+		// the mask is only unset on the server when a later call needs it unset
+		setClipState(None, srcx, srcy);
 	}
 
-	/// Sleeps the game for a period of milliseconds.
-	///  @time The number of milliseconds to sleep the game.
-	void wait(long time)
+	/// Draws an image with a clipping mask from its server-side copy if it has one, in screen coordinates.
+	///  @x The x-coordinate (in screen coordinates) to draw the image.
+	///  @y The y-coordinate (in screen coordinates) to draw the image.
+	///  @posx The x-coordinate (in image coordinates) to draw the image.
+	///  @posy The y-coordinate (in image coordinates) to draw the image.
+	///  @width The width of the image to draw.
+	///  @height The height of the image to draw.
+	///  @img A pointer to the image asset to be drawn.
+	///  @surface The server-side copy of the image, or None.
+	///  @mask A pointer to the clipmask of the image.
+	void drawSurface(int x, int y, int posx, int posy, int width, int height, XImage* img, Pixmap surface, Pixmap mask)
 	{
-		usleep(time);
+		if(compositor != NULL || surface == None)
+		{
+			drawImage(x, y, posx, posy, width, height, img, mask);
+			return;
+		}
+
+		int srcx = x - posx;
+		int srcy = y - posy;
+		if(isRecording() || batching)
+		{
+			BatchCommand command = createCommand(BATCH_SURFACE, gdraw, x, y, width, height);
+			command.surface = surface;
+			command.posx = posx;
+			command.posy = posy;
+			command.mask = mask;
+			command.originX = srcx;
+			command.originY = srcy;
+			getBatch().add(command);
+
+			setClipState(None, srcx, srcy);
+			return;
+		}
+
+		applyClip(mask, srcx, srcy);
+		XCopyArea(display, surface, pixmap, gdraw, posx, posy, width, height, x, y);
+		setClipState(None, srcx, srcy);
 	}
 
-	/// Returns the window size hints.
-	///  @returns The window size hints.
-	XSizeHints getWindowHints(void)
+	/// Draws a frame of a spritesheet, unless it is out of view.
+	///  @sheet The spritesheet to draw the frame from.
+	///  @frame The frame, in image coordinates.
+	///  @x The x-coordinate (in world coordinates) of the sprite cell.
+	///  @y The y-coordinate (in world coordinates) of the sprite cell.
+	void drawFrame(Spritesheet* sheet, const SpriteFrame& frame, int x, int y)
 	{
-		return hints;
+		if(frame.width == 0 || frame.height == 0)
+		{
+			return;
+		}
+
+		int srcx, srcy;
+		int posx = frame.x;
+		int posy = frame.y;
+		int width = frame.width;
+		int height = frame.height;
+		x += frame.offsetX;
+		y += frame.offsetY;
+		if(!toScreen(x, y, width, height))
+		{
+			return;
+		}
+
+		if(compositor != NULL && !isRecording())
+		{
+			blit(sheet->getImage(), posx, posy, x, y, width, height);
+			return;
+		}
+
+		srcx = x - posx;
+		srcy = y - posy;
+
+		Pixmap mask = sheet->getMask();
+		if(isRecording() || batching)
+		{
+			BatchCommand command = createCommand(BATCH_IMAGE, gdraw, x, y, width, height);
+			if(sheet->getSurface() != None)
+			{
+				command.type = BATCH_SURFACE;
+				command.surface = sheet->getSurface();
+			}
+			else
+			{
+				command.image = sheet->getImage();
+			}
+			command.posx = posx;
+			command.posy = posy;
+			command.mask = mask != None ? mask : clip_mask;
+			command.originX = srcx;
+			command.originY = srcy;
+			getBatch().add(command);
+
+			setClipState(mask != None ? None : clip_mask, srcx, srcy);
+			return;
+		}
+
+		applyClip(mask != None ? mask : clip_mask, srcx, srcy);
+
+		if(sheet->getSurface() != None)
+		{
+			// the sheet already lives on the server, so only the copy request is sent
+			XCopyArea(display, sheet->getSurface(), pixmap, gdraw,
+				posx, posy,
+				width, height,
+				x, y);
+		}
+		else
+		{
+			putImage(sheet->getImage(),
+				posx, posy,
+				x, y,
+				width, height);
+		}
+
+		setClipState(mask != None ? None : clip_mask, srcx, srcy);
 	}
 
-	/// Returns the current Keyboard state.
-	///  @returns The current keyboard state. 
-	KeyboardState* getKeyboardState(void)
+	/// Composites a region of an image into the software frame buffer.
+	///  @img The image to draw from.
+	///  @posx The x-coordinate (in image coordinates) of the region.
+	///  @posy The y-coordinate (in image coordinates) of the region.
+	///  @x The x-coordinate (in screen coordinates) to draw the region.
+	///  @y The y-coordinate (in screen coordinates) to draw the region.
+	///  @width The width of the region.
+	///  @height The height of the region.
+	void blit(XImage* img, int posx, int posy, int x, int y, int width, int height)
 	{
-		return keyboard;
+		compositor->blit((const uint32_t*)img->data, img->bytes_per_line / 4, img->width, img->height,
+			posx, posy, x, y, width, height);
 	}
 
-	/// Returns the current Mouse state.
-	///  @returns The current mouse state. 
-	MouseState* getMouseState(void)
+	/// Rasterizes the software frame, uploads it to the image buffer and draws the queued strings over it.
+	void present(void)
 	{
-		return mouse;
+		compositor->render();
+
+		applyClipMask(gdraw, None);
+		putImage(backbuffer, 0, 0, 0, 0, compositor->getWidth(), compositor->getHeight());
+
+		for(size_t i = 0; i < texts.size(); i++)
+		{
+			renderString(texts[i].text, texts[i].x, texts[i].y, texts[i].colour);
+		}
+		texts.clear();
+
+		// the server reads a shared frame buffer asynchronously, so wait before the next frame overwrites it
+		if(backbuffer->obdata != NULL)
+		{
+			XSync(display, False);
+		}
 	}
 
-	/// Gets the current display device.
-	///  @returns The current display device.
-	Display* getDisplay(void)
+	/// Clears the alpha of every image pixel that is unset in a clipping mask.
+	///  @img The image to mask.
+	///  @bits The mask bits, in XBM format.
+	///  @width The width of the mask.
+	///  @height The height of the mask.
+	void applyMask(XImage* img, const unsigned char* bits, int width, int height)
 	{
-		return display;
+		int pitch = (width + 7) / 8;
+		for(int y = 0; y < height && y < img->height; y++)
+		{
+			uint32_t* row = (uint32_t*)(img->data + y * img->bytes_per_line);
+			for(int x = 0; x < width && x < img->width; x++)
+			{
+				if(((bits[y * pitch + x / 8] >> (x % 8)) & 1) == 0)
+				{
+					row[x] &= Blitter::COLOR_MASK;
+				}
+			}
+		}
 	}
 
-	/// Gets the underlying operating system window.
-	///  @returns The application window.
-	Window getWindow(void)
+	/// Reads the size of a QOI or TGA image.
+	///  @data The contents of the image file.
+	///  @size The size of the contents in bytes.
+	///  @width The width of the image.
+	///  @height The height of the image.
+	///  @returns True if the file is a supported image, false otherwise.
+	static bool readImageSize(const unsigned char* data, size_t size, int* width, int* height)
 	{
-		return window;
+		if(Qoi::isQoi(data, size))
+		{
+			Qoi::QoiHeader header;
+			if(!Qoi::readHeader(data, size, &header))
+			{
+				return false;
+			}
+			*width = header.width;
+			*height = header.height;
+			return true;
+		}
+
+		TgaLoader::TgaHeader header;
+		if(!TgaLoader::readHeader(data, size, &header))
+		{
+			return false;
+		}
+		*width = header.width;
+		*height = header.height;
+		return true;
 	}
 
-	/// Gets the screen number for the application.
-	///  @returns The screen number.
-	int getScreen(void)
+	/// Decodes a QOI or TGA image, choosing the decoder from the contents of the file.
+	///  @data The contents of the image file.
+	///  @size The size of the contents in bytes.
+	///  @pixels The destination pixels, large enough to hold the image.
+	///  @stride The number of pixels between the start of two destination rows.
+	///  @returns True if successful, false otherwise.
+	static bool decodeImage(const unsigned char* data, size_t size, uint32_t* pixels, int stride)
 	{
-		return screen;
+		if(Qoi::isQoi(data, size))
+		{
+			Qoi::QoiHeader header;
+			return Qoi::readHeader(data, size, &header) && Qoi::decode(data, size, header, pixels, stride);
+		}
+
+		TgaLoader::TgaHeader header;
+		return TgaLoader::readHeader(data, size, &header) && TgaLoader::decode(data, size, header, pixels, stride);
 	}
 
-	/// Creates a graphic context from the current display.
-	///  @returns A newly created graphic context.
-	GC createGraphicContext(void)
+	/// Decodes the image of a load request and packs its mask. Runs on a load worker, so it touches no
+	///  X resources and no state of the XInfo besides the completed queue.
+	///  @request The request.
+	void decodeRequest(LoadRequest* request)
 	{
-		return XCreateGC(display, window, 0, 0);
+		MappedFile file;
+		if(!file.open(request->filename.c_str()) || !readImageSize(file.getData(), file.getSize(), &request->width, &request->height))
+		{
+			request->failed = true;
+		}
+		else
+		{
+			request->pixels = (char*)malloc((size_t)request->width * request->height * 4);
+			if(request->pixels == NULL)
+			{
+				request->failed = true;
+			}
+			else if(!decodeImage(file.getData(), file.getSize(), (uint32_t*)request->pixels, request->width))
+			{
+				free(request->pixels);
+				request->pixels = NULL;
+				request->failed = true;
+			}
+			else if(request->masked)
+			{
+				int pitch = (request->width + 7) / 8;
+				request->mask.resize((size_t)pitch * request->height);
+				for(int y = 0; y < request->height; y++)
+				{
+					const uint32_t* row = (const uint32_t*)request->pixels + (size_t)y * request->width;
+					if(request->keyed)
+					{
+						Blitter::keyMaskRow(&request->mask[y * pitch], row, request->width, request->key);
+					}
+					else
+					{
+						Blitter::alphaMaskRow(&request->mask[y * pitch], row, request->width);
+					}
+				}
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(load_mutex);
+			load_completed.push_back(request);
+		}
+		load_done.notify_one();
 	}
 
-	/// Gets the collection of graphic contexts for the application.
-	///  @returns A collection of graphic contexts.
-	GC* getGraphicDevices(void)
+	/// Creates the X resources of a decoded load request and hands them to the requester.
+	///  @request The request, which is deleted.
+	void finishRequest(LoadRequest* request)
 	{
-		return gcontext;
+		loads_completed++;
+
+		if(request->failed)
+		{
+			load_failures++;
+			Logger::application_debug(Logger::LOG_ASSETERROR, request->filename.c_str());
+		}
+		else
+		{
+			XImage* image = createImage(request->pixels, request->width, request->height);
+			if(!request->mask.empty())
+			{
+				std::unique_lock<std::mutex> lock = lockDisplay();
+				masks[image] = XCreateBitmapFromData(display, window, (const char*)&request->mask[0], request->width, request->height);
+			}
+
+			(*request->img) = image;
+			if(request->pxm != NULL)
+			{
+				(*request->pxm) = getMask(image);
+			}
+		}
+
+		delete request;
 	}
 
-	/// Returns the graphic context associated with image-based rendering.
-	///  @returns The graphic context responsible for image-based rendering.
-	GC getGraphicContext(void)
+	/// Builds the clipping mask of an image in a single pass over its pixels.
+	///  @img The image.
+	///  @returns The clipping mask.
+	Pixmap createMask(XImage* img)
 	{
-		return gcontext[0];
+		int pitch = (img->width + 7) / 8;
+		mask_bits.resize(pitch * img->height);
+
+		for(int y = 0; y < img->height; y++)
+		{
+			const uint32_t* row = (const uint32_t*)(img->data + y * img->bytes_per_line);
+			if(color_keyed)
+			{
+				Blitter::keyMaskRow(&mask_bits[y * pitch], row, img->width, color_key);
+			}
+			else
+			{
+				Blitter::alphaMaskRow(&mask_bits[y * pitch], row, img->width);
+			}
+		}
+
+		return XCreateBitmapFromData(display, window, (const char*)&mask_bits[0], img->width, img->height);
 	}
 
-	/// Returns the graphics context associated with text-based rendering.
-	///  @returns The graphic context responsible for text-based rendering.
-	GC getTextDevice(void)
+	/// Returns the foreground color of a graphics context, from the client-side copy of its values.
+	///  @gc The graphics context.
+	///  @returns The foreground color.
+	uint32_t getForeground(GC gc)
 	{
-		return gcontext[1];
+		// the context may be drawing a snapshot on another thread, so recorded calls use the colors set
+		// through setColor, and only read the context for one never set
+		if(isRecording())
+		{
+			std::map<GC, unsigned long>::iterator found = colours.find(gc);
+			if(found != colours.end())
+			{
+				return (uint32_t)found->second;
+			}
+
+			std::lock_guard<std::mutex> lock(display_mutex);
+			XGCValues values;
+			XGetGCValues(display, gc, GCForeground, &values);
+			colours[gc] = values.foreground;
+			return (uint32_t)values.foreground;
+		}
+
+		XGCValues values;
+		XGetGCValues(display, gc, GCForeground, &values);
+		return (uint32_t)values.foreground;
 	}
 
-	/// Returns the default font used when rendering text.
-	///  @returns A graphics font.
-	XFontStruct* getDefaultFont(void)
+	/// Uploads a region of an image to the image buffer.
+	///  @img The image to upload from.
+	///  @posx The x-coordinate (in image coordinates) of the region.
+	///  @posy The y-coordinate (in image coordinates) of the region.
+	///  @x The x-coordinate (in screen coordinates) of the destination.
+	///  @y The y-coordinate (in screen coordinates) of the destination.
+	///  @width The width of the region.
+	///  @height The height of the region.
+	void putImage(XImage* img, int posx, int posy, int x, int y, int width, int height)
 	{
-		return font;
+		putImage(pixmap, img, posx, posy, x, y, width, height);
 	}
 
-	/// Returns the render-target surface for the application.
-	///  @returns The render-target surface of the application.
-	Pixmap getImageBuffer(void)
+	/// Uploads a region of an image to a drawable.
+	///  @target The drawable to upload to.
+	///  @img The image to upload from.
+	///  @posx The x-coordinate (in image coordinates) of the region.
+	///  @posy The y-coordinate (in image coordinates) of the region.
+	///  @x The x-coordinate of the destination.
+	///  @y The y-coordinate of the destination.
+	///  @width The width of the region.
+	///  @height The height of the region.
+	void putImage(Drawable target, XImage* img, int posx, int posy, int x, int y, int width, int height)
 	{
-		return pixmap;
+		if(img->obdata != NULL)
+		{
+			XShmPutImage(display, target, gdraw, img, posx, posy, x, y, width, height, False);
+		}
+		else
+		{
+			XPutImage(display, target, gdraw, img, posx, posy, x, y, width, height);
+		}
 	}
 
-	/// Returns the window dimensions of a render-target surface.
-	///  @returns The dimensions of the image buffer.
-	Rectangle* getGraphicBounds(void)
+	/// Creates an empty image in a new shared memory segment attached to the display.
+	///  @width The width of the image.
+	///  @height The height of the image.
+	///  @returns The created image, or NULL if the segment could not be created.
+	XImage* createSharedImage(int width, int height)
 	{
-		return pix_bounds;
+		int depth = DefaultDepth(display, screen);
+		Visual* visual = DefaultVisual(display, screen);
+
+		// allocated with malloc, as XDestroyImage frees it along with the image
+		XShmSegmentInfo* info = (XShmSegmentInfo*)malloc(sizeof(XShmSegmentInfo));
+		XImage* image = XShmCreateImage(display, visual, depth, ZPixmap, NULL, info, width, height);
+		if(image == NULL)
+		{
+			free(info);
+			return NULL;
+		}
+
+		if(!attachSharedMemory(info, image->bytes_per_line * image->height))
+		{
+			image->obdata = NULL;
+			XDestroyImage(image);
+			free(info);
+			return NULL;
+		}
+
+		image->data = info->shmaddr;
+		return image;
 	}
 
-	/// Returns the window width of a render-target surface.
-	///  @returns The width of the image buffer.
-	float getImageWidth(void)
+	/// Creates a shared memory segment and attaches it to the display.
+	///  @info The segment information to fill.
+	///  @size The size of the segment in bytes.
+	///  @returns True if successful, false otherwise.
+	bool attachSharedMemory(XShmSegmentInfo* info, int size)
 	{
-		return pix_bounds->getWidth();
+		info->shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+		if(info->shmid < 0)
+		{
+			return false;
+		}
+
+		info->shmaddr = (char*)shmat(info->shmid, 0, 0);
+		info->readOnly = False;
+		if(info->shmaddr == (char*)-1)
+		{
+			shmctl(info->shmid, IPC_RMID, 0);
+			return false;
+		}
+
+		// attaching fails asynchronously on remote displays, so the error is trapped through a sync
+		shmError() = false;
+		XErrorHandler handler = XSetErrorHandler(handleSharedMemoryError);
+		XShmAttach(display, info);
+		XSync(display, False);
+		XSetErrorHandler(handler);
+
+		// the segment is destroyed once both sides have detached
+		shmctl(info->shmid, IPC_RMID, 0);
+
+		if(shmError())
+		{
+			shmdt(info->shmaddr);
+			return false;
+		}
+		return true;
 	}
 
-	/// Returns the window height of a render-target surface.
-	///  @returns The height of the image buffer.
-	float getImageHeight(void)
+	/// Determines whether shared memory images can be used with the current display.
+	///  @returns True if shared memory is supported, false otherwise.
+	bool querySharedMemory(void)
 	{
-		return pix_bounds->getHeight();
+		if(!XShmQueryExtension(display))
+		{
+			return false;
+		}
+
+		XShmSegmentInfo info;
+		if(!attachSharedMemory(&info, 1))
+		{
+			Logger::application_debug(Logger::LOG_SHMUNAVAILABLE);
+			return false;
+		}
+
+		XShmDetach(display, &info);
+		XSync(display, False);
+		shmdt(info.shmaddr);
+		return true;
 	}
 
-	/// Sets the icon of the window for initialization.
-	void setIcon(const char* wicon)
+	/// Records a failure to attach a shared memory segment.
+	static int handleSharedMemoryError(Display*, XErrorEvent*)
 	{
-		icon = wicon;
+		shmError() = true;
+		return 0;
 	}
 
-	/// Sets the title of the window for initialization.
-	void setTitle(const char* wtitle)
+	/// Returns whether the last shared memory attach failed.
+	static bool& shmError(void)
 	{
-		title = wtitle;
+		static bool error = false;
+		return error;
 	}
 
-private:
 	/// XLib variables
-	Display *display;
+	Display *display = NULL;
 	Window window;
 	XSizeHints hints;
 	int windowWidth, windowHeight;
@@ -585,6 +3473,78 @@ private:
 	int border;
 	unsigned int input_mask;
 
+	/// Shared memory images
+	bool shm_enabled = true;
+	bool shm_available = false;
+
+	/// Software rendering
+	RENDER_BACKEND backend = RENDER_XLIB;
+	Compositor* compositor = NULL;
+	ThreadPool* render_pool = NULL;
+	int render_threads = -1;
+	XImage* backbuffer = NULL;
+	std::vector<TextItem> texts;
+
+	/// Images shared through the asset cache
+	AssetCache cache;
+
+	/// Clipping masks built from images, and the color key they are built with
+	std::map<XImage*, Pixmap> masks;
+	std::set<XImage*> borrowed;
+	std::vector<unsigned char> mask_bits;
+	bool color_keyed = false;
+	uint32_t color_key = 0;
+
+	/// Background loading
+	ThreadPool* load_pool = NULL;
+	std::mutex load_mutex;
+	std::condition_variable load_done;
+	std::vector<LoadRequest*> load_completed;
+	int loads_requested = 0;
+	int loads_completed = 0;
+	int load_failures = 0;
+
+	/// Draw call batching
+	DrawBatch batch;
+	bool batching = false;
+	std::vector<XRectangle> batch_rects;
+	std::vector<XSegment> batch_segments;
+
+	/// The view of the world, and the lists of rectangles and segments it last moved to the screen
+	Camera camera;
+	std::vector<XRectangle> screen_rects;
+	std::vector<XSegment> screen_segments;
+	std::vector<unsigned long> batch_colours;
+
+	/// Damage tracking
+	bool damage_tracking = false;
+	bool clear_pending = false;
+	bool capture_pending = false;
+	DamageRegion* damage = NULL;
+	DamageRegion* previous_damage = NULL;
+	std::vector<XRectangle> damage_rects;
+	Pixmap background = None;
+
+	/// Cached state of the owned graphics contexts
+	GraphicState gstate[2];
+	int requests_issued = 0;
+	int requests_avoided = 0;
+	int frame_changes = 0;
+	int frame_avoided = 0;
+
+	/// Clip state of the sprite graphics context, as left by the last call
+	Pixmap clip_mask = None;
+	int clip_x = 0;
+	int clip_y = 0;
+
+	/// Recorded snapshots: the colors set for them, the lock against the thread presenting them, and the
+	///  resources released while recording
+	std::map<GC, unsigned long> colours;
+	std::mutex display_mutex;
+	std::vector<RetiredResource> retired;
+	unsigned long frames_recorded = 0;
+	unsigned long frames_presented = 0;
+
 	// Information
 	const char* title = NULL;
 	const char* icon = NULL;
@@ -0,0 +1,56 @@
+#ifndef _INCL_IMAGEFILE
+#define _INCL_IMAGEFILE
+
+/// Standard libraries
+#include <stdint.h>
+#include <vector>
+
+/// Project components
+#include "MappedFile.h"
+#include "TgaLoader.h"
+#include "Qoi.h"
+
+/// Decodes a TGA or QOI image into 32-bit pixels.
+///  @filename The path of the image.
+///  @pixels The decoded pixels.
+///  @width The width of the image.
+///  @height The height of the image.
+///  @returns True if successful, false otherwise.
+static bool readImage(const char* filename, std::vector<uint32_t>& pixels, int* width, int* height)
+{
+	MappedFile file;
+	if(!file.open(filename))
+	{
+		return false;
+	}
+
+	const unsigned char* data = file.getData();
+	size_t size = file.getSize();
+
+	if(Qoi::isQoi(data, size))
+	{
+		Qoi::QoiHeader header;
+		if(!Qoi::readHeader(data, size, &header))
+		{
+			return false;
+		}
+
+		*width = header.width;
+		*height = header.height;
+		pixels.resize((size_t)header.width * header.height);
+		return Qoi::decode(data, size, header, &pixels[0], header.width);
+	}
+
+	TgaLoader::TgaHeader header;
+	if(!TgaLoader::readHeader(data, size, &header))
+	{
+		return false;
+	}
+
+	*width = header.width;
+	*height = header.height;
+	pixels.resize((size_t)header.width * header.height);
+	return TgaLoader::decode(data, size, header, &pixels[0], header.width);
+}
+
+#endif
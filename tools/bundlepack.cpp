@@ -0,0 +1,224 @@
+/// bundlepack
+///	 Packs images and animations into an asset bundle, converted ahead of time into the form XInfo
+///  draws them in.  The assets are listed in a manifest, one per line:
+///
+///    # a comment
+///    colorkey FF00FF                          images after this line are masked by a color, or "none"
+///    image <name> <file> [columns rows margins]   a TGA or QOI image, optionally a spritesheet grid
+///    animation <name> <start> <end>           a range of sprite indices
+///
+///  Image files are relative to the directory of the manifest.
+///
+///  Usage: bundlepack <manifest> <output>
+
+/// Standard libraries
+#include <stdio.h>
+#include <stdint.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/// Project components
+#include "AssetBundle.h"
+#include "Blitter.h"
+#include "ImageFile.h"
+
+/// The data of an entry, before its offsets in the file are known.
+struct PackedEntry
+{
+	BundleEntry entry;
+	std::vector<uint32_t> pixels;
+	std::vector<unsigned char> mask;
+};
+
+/// Converts an image into its bundled form: color-keyed pixels become transparent, and the mask is
+///  built from the alpha. Fully opaque images are given no mask, so they are drawn unclipped.
+///  @packed The entry holding the decoded image.
+///  @keyed True if a color key is set.
+///  @key The color key.
+static void convertImage(PackedEntry& packed, bool keyed, uint32_t key)
+{
+	int width = packed.entry.width;
+	int height = packed.entry.height;
+	int pitch = (width + 7) / 8;
+	bool opaque = true;
+
+	packed.mask.resize(AssetBundle::getMaskSize(width, height));
+	for(int y = 0; y < height; y++)
+	{
+		uint32_t* row = &packed.pixels[(size_t)y * width];
+		for(int x = 0; keyed && x < width; x++)
+		{
+			if((row[x] & Blitter::COLOR_MASK) == key)
+			{
+				row[x] &= Blitter::COLOR_MASK;
+			}
+		}
+
+		unsigned char* bits = &packed.mask[(size_t)y * pitch];
+		Blitter::alphaMaskRow(bits, row, width);
+		for(int x = 0; x < width; x++)
+		{
+			opaque = opaque && (bits[x >> 3] >> (x & 7) & 1);
+		}
+	}
+
+	if(opaque)
+	{
+		packed.mask.clear();
+	}
+}
+
+/// Appends data to the file, aligned for direct use from the mapping.
+///  @out The file contents.
+///  @data The data.
+///  @size The size of the data in bytes.
+///  @returns The offset of the data.
+static uint32_t append(std::vector<unsigned char>& out, const void* data, size_t size)
+{
+	out.resize((out.size() + AssetBundle::ALIGNMENT - 1) / AssetBundle::ALIGNMENT * AssetBundle::ALIGNMENT);
+	uint32_t offset = (uint32_t)out.size();
+	out.insert(out.end(), (const unsigned char*)data, (const unsigned char*)data + size);
+	return offset;
+}
+
+int main(int argc, char* argv[])
+{
+	if(argc != 3)
+	{
+		fprintf(stderr, "Usage: %s <manifest> <output>\n", argv[0]);
+		return 1;
+	}
+
+	FILE* manifest = fopen(argv[1], "r");
+	if(manifest == NULL)
+	{
+		fprintf(stderr, "%s: cannot read manifest %s\n", argv[0], argv[1]);
+		return 1;
+	}
+
+	std::string directory = argv[1];
+	size_t slash = directory.rfind('/');
+	directory = slash == std::string::npos ? "" : directory.substr(0, slash + 1);
+
+	std::vector<PackedEntry> packed;
+	bool keyed = false;
+	uint32_t key = 0;
+
+	char line[1024];
+	int number = 0;
+	while(fgets(line, sizeof(line), manifest) != NULL)
+	{
+		number++;
+
+		char command[32], name[256], file[768];
+		int a = 0, b = 0, c = 0;
+		int fields = sscanf(line, "%31s %255s %767s %d %d %d", command, name, file, &a, &b, &c);
+		if(fields <= 0 || command[0] == '#')
+		{
+			continue;
+		}
+
+		PackedEntry entry;
+		memset(&entry.entry, 0, sizeof(entry.entry));
+		if(fields >= 2 && strlen(name) >= sizeof(entry.entry.name))
+		{
+			fprintf(stderr, "%s:%d: name %s is too long\n", argv[1], number, name);
+			return 1;
+		}
+
+		if(strcmp(command, "colorkey") == 0 && fields == 2)
+		{
+			keyed = strcmp(name, "none") != 0;
+			key = (uint32_t)strtoul(name, NULL, 16) & Blitter::COLOR_MASK;
+		}
+		else if(strcmp(command, "image") == 0 && (fields == 3 || fields == 6))
+		{
+			std::string path = file[0] == '/' ? file : directory + file;
+			if(!readImage(path.c_str(), entry.pixels, &entry.entry.width, &entry.entry.height))
+			{
+				fprintf(stderr, "%s:%d: cannot read image %s\n", argv[1], number, path.c_str());
+				return 1;
+			}
+
+			strcpy(entry.entry.name, name);
+			entry.entry.type = BUNDLE_IMAGE;
+			if(fields == 6)
+			{
+				if(a <= 0 || b <= 0 || c < 0)
+				{
+					fprintf(stderr, "%s:%d: invalid spritesheet grid\n", argv[1], number);
+					return 1;
+				}
+				entry.entry.columns = a;
+				entry.entry.rows = b;
+				entry.entry.margins = c;
+			}
+
+			convertImage(entry, keyed, key);
+			packed.push_back(entry);
+		}
+		else if(strcmp(command, "animation") == 0 && sscanf(line, "%*s %*s %d %d", &a, &b) == 2)
+		{
+			if(a < 0 || a > b)
+			{
+				fprintf(stderr, "%s:%d: invalid animation range\n", argv[1], number);
+				return 1;
+			}
+
+			strcpy(entry.entry.name, name);
+			entry.entry.type = BUNDLE_ANIMATION;
+			entry.entry.start = a;
+			entry.entry.end = b;
+			packed.push_back(entry);
+		}
+		else
+		{
+			fprintf(stderr, "%s:%d: cannot parse line\n", argv[1], number);
+			return 1;
+		}
+	}
+	fclose(manifest);
+
+	// the table of contents follows the header, and the data of every image follows the table
+	std::vector<unsigned char> out(sizeof(BundleHeader) + packed.size() * sizeof(BundleEntry));
+	for(size_t i = 0; i < packed.size(); i++)
+	{
+		BundleEntry& entry = packed[i].entry;
+		if(entry.type == BUNDLE_IMAGE)
+		{
+			entry.pixels = append(out, &packed[i].pixels[0], packed[i].pixels.size() * 4);
+			if(!packed[i].mask.empty())
+			{
+				entry.mask = append(out, &packed[i].mask[0], packed[i].mask.size());
+			}
+		}
+	}
+
+	BundleHeader header;
+	memcpy(header.magic, "XGLB", 4);
+	header.version = AssetBundle::VERSION;
+	header.entryCount = (uint32_t)packed.size();
+	header.entries = sizeof(BundleHeader);
+	memcpy(&out[0], &header, sizeof(header));
+	for(size_t i = 0; i < packed.size(); i++)
+	{
+		memcpy(&out[sizeof(BundleHeader) + i * sizeof(BundleEntry)], &packed[i].entry, sizeof(BundleEntry));
+	}
+
+	FILE* bundle = fopen(argv[2], "wb");
+	if(bundle == NULL || fwrite(&out[0], 1, out.size(), bundle) != out.size())
+	{
+		fprintf(stderr, "%s: cannot write bundle %s\n", argv[0], argv[2]);
+		if(bundle != NULL)
+		{
+			fclose(bundle);
+		}
+		return 1;
+	}
+	fclose(bundle);
+
+	printf("%s: %lu assets, %lu bytes\n", argv[2], (unsigned long)packed.size(), (unsigned long)out.size());
+	return 0;
+}
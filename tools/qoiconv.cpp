@@ -0,0 +1,94 @@
+/// qoiconv
+///	 Converts images between the formats XInfo::loadImage reads.  Any TGA or QOI image is converted to
+///  QOI, or to an uncompressed 32-bit TGA when the output file ends in ".tga".
+///
+///  Usage: qoiconv <input> <output>
+
+/// Standard libraries
+#include <stdio.h>
+#include <stdint.h>
+#include <cstring>
+#include <vector>
+
+/// Project components
+#include "TgaLoader.h"
+#include "Qoi.h"
+#include "ImageFile.h"
+
+/// Encodes 32-bit pixels as an uncompressed, top-down 32-bit TGA image.
+///  @pixels The pixels.
+///  @width The width of the image.
+///  @height The height of the image.
+///  @out The buffer the image is appended to.
+static void encodeTga(const std::vector<uint32_t>& pixels, int width, int height, std::vector<unsigned char>& out)
+{
+	unsigned char header[TgaLoader::HEADER_SIZE];
+	memset(header, 0, sizeof(header));
+	header[2] = TgaLoader::TGA_TRUECOLOR;
+	header[12] = width & 0xFF;
+	header[13] = width >> 8;
+	header[14] = height & 0xFF;
+	header[15] = height >> 8;
+	header[16] = 32;
+	header[17] = 0x28;
+
+	// 0xAARRGGBB pixels are stored as BGRA on little-endian hosts, which is the TGA byte order
+	const unsigned char* bytes = (const unsigned char*)&pixels[0];
+	out.insert(out.end(), header, header + sizeof(header));
+	out.insert(out.end(), bytes, bytes + pixels.size() * 4);
+}
+
+/// Determines whether a filename ends with an extension, ignoring case.
+static bool hasExtension(const char* filename, const char* extension)
+{
+	size_t length = strlen(filename);
+	size_t extensionLength = strlen(extension);
+	return length >= extensionLength && strcasecmp(filename + length - extensionLength, extension) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if(argc != 3)
+	{
+		fprintf(stderr, "Usage: %s <input.tga|input.qoi> <output.qoi|output.tga>\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<uint32_t> pixels;
+	int width = 0, height = 0;
+	if(!readImage(argv[1], pixels, &width, &height))
+	{
+		fprintf(stderr, "%s: cannot read image %s\n", argv[0], argv[1]);
+		return 1;
+	}
+
+	std::vector<unsigned char> out;
+	if(hasExtension(argv[2], ".tga"))
+	{
+		if(width > 0xFFFF || height > 0xFFFF)
+		{
+			fprintf(stderr, "%s: image is too large for TGA\n", argv[0]);
+			return 1;
+		}
+		encodeTga(pixels, width, height, out);
+	}
+	else
+	{
+		Qoi::encode(&pixels[0], width, height, width, out);
+	}
+
+	FILE* file = fopen(argv[2], "wb");
+	if(file == NULL || fwrite(&out[0], 1, out.size(), file) != out.size())
+	{
+		fprintf(stderr, "%s: cannot write image %s\n", argv[0], argv[2]);
+		if(file != NULL)
+		{
+			fclose(file);
+		}
+		return 1;
+	}
+	fclose(file);
+
+	printf("%s: %dx%d, %lu bytes\n", argv[2], width, height, (unsigned long)out.size());
+	return 0;
+}